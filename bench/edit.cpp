@@ -0,0 +1,268 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Measures the editing primitives of the buffer on texts from 1 KiB up
+// to 4 GiB, with short, typical and long lines, and with the cursor at
+// the start, in the middle and at the end of the text, to keep track of
+// how they scale.  Use --benchmark_format=json to get results that can
+// be compared between versions.
+//
+// Only texts up to 32 MiB are used by default, since the biggest ones
+// take a long time to build and a lot of memory.  The limit can be
+// changed with the environment variable EWIG_BENCH_MAX_BYTES, which
+// accepts the suffixes K, M and G, for example:
+//
+//     EWIG_BENCH_MAX_BYTES=4G ./ewig-bench-edit --benchmark_format=json
+
+#include <ewig/buffer.hpp>
+
+#include <benchmark/benchmark.h>
+#include <immer/flex_vector_transient.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const auto all_sizes = std::vector<std::int64_t>{
+    1ll << 10, 1ll << 15, 1ll << 20, 1ll << 25, 1ll << 30, 1ll << 32};
+
+const auto line_lengths = std::vector<std::int64_t>{16, 80, 4096};
+
+const auto default_max_bytes = std::int64_t{1} << 25;
+
+// Rows of the selection that is copied or cut
+const auto selection_rows = ewig::index{10};
+
+enum class position { start, middle, end };
+
+std::int64_t max_bytes()
+{
+    auto env = std::getenv("EWIG_BENCH_MAX_BYTES");
+    if (!env || !*env)
+        return default_max_bytes;
+    auto str   = std::string{env};
+    auto error = std::runtime_error{"invalid EWIG_BENCH_MAX_BYTES: " + str};
+    auto pos   = std::size_t{};
+    auto value = std::int64_t{};
+    try {
+        value = std::stoll(str, &pos);
+    } catch (const std::logic_error&) {
+        throw error;
+    }
+    auto unit = str.substr(pos);
+    if (unit == "K")      value <<= 10;
+    else if (unit == "M") value <<= 20;
+    else if (unit == "G") value <<= 30;
+    else if (!unit.empty())
+        throw error;
+    return value;
+}
+
+// Builds a text of about `bytes` in lines of `line_length` characters,
+// with some tabs.  Only a few different lines are made and reused for
+// all rows, which keeps the biggest texts in memory, while the vector
+// of lines is still as big as it would be with all of them different.
+ewig::text make_text(std::int64_t bytes, std::int64_t line_length)
+{
+    auto lines = std::vector<ewig::line>{};
+    for (auto i = 0; i < 64; ++i) {
+        auto ln = ewig::line{}.transient();
+        for (auto j = std::int64_t{}; j < line_length; ++j)
+            ln.push_back(j % 32 == 31 ? '\t' : 'a' + (i + j) % 26);
+        lines.push_back(ln.persistent());
+    }
+    auto rows = std::max(bytes / (line_length + 1), std::int64_t{1});
+    auto txt  = ewig::text{}.transient();
+    for (auto i = std::int64_t{}; i < rows; ++i)
+        txt.push_back(lines[i % lines.size()]);
+    return txt.persistent();
+}
+
+// Building the biggest texts takes long, so the last one is kept for
+// the benchmarks that follow, which use the same one
+const ewig::text& cached_text(std::int64_t bytes, std::int64_t line_length)
+{
+    static auto key = std::pair<std::int64_t, std::int64_t>{};
+    static auto txt = ewig::text{};
+    if (key != std::pair{bytes, line_length}) {
+        txt = {};
+        txt = make_text(bytes, line_length);
+        key = {bytes, line_length};
+    }
+    return txt;
+}
+
+ewig::buffer make_buffer(benchmark::State& state, position pos)
+{
+    auto buf = ewig::buffer{};
+    buf.content = cached_text(state.range(0), state.range(1));
+    auto rows = ewig::index(buf.content.size());
+    auto row  = pos == position::start  ? 0
+              : pos == position::middle ? rows / 2
+              : rows - 1;
+    buf.cursor = {row, ewig::index(state.range(1) / 2)};
+    return buf;
+}
+
+// Selects some rows from the cursor on, or up to it at the end
+ewig::buffer make_selection(benchmark::State& state, position pos)
+{
+    auto buf  = make_buffer(state, pos);
+    auto rows = ewig::index(buf.content.size());
+    auto from = buf.cursor;
+    if (pos == position::end)
+        from.row = std::max(from.row - selection_rows, ewig::index{});
+    else
+        buf.cursor.row = std::min(from.row + selection_rows, rows - 1);
+    buf.selection_start = from;
+    return buf;
+}
+
+template <typename Fn>
+void run(benchmark::State& state, const ewig::buffer& buf, Fn fn)
+{
+    for (auto _ : state)
+        benchmark::DoNotOptimize(fn(buf));
+    state.SetItemsProcessed(state.iterations());
+}
+
+void bm_insert_char(benchmark::State& state, position pos)
+{
+    run(state, make_buffer(state, pos), [] (auto buf) {
+        return ewig::insert_char(buf, L'x');
+    });
+}
+
+void bm_delete_char(benchmark::State& state, position pos)
+{
+    run(state, make_buffer(state, pos), ewig::delete_char);
+}
+
+void bm_insert_new_line(benchmark::State& state, position pos)
+{
+    run(state, make_buffer(state, pos), ewig::insert_new_line);
+}
+
+void bm_insert_text(benchmark::State& state, position pos)
+{
+    auto paste = make_text(selection_rows * (state.range(1) + 1), state.range(1));
+    run(state, make_buffer(state, pos), [&] (auto buf) {
+        return ewig::insert_text(buf, paste);
+    });
+}
+
+void bm_cut(benchmark::State& state, position pos)
+{
+    run(state, make_selection(state, pos), ewig::cut);
+}
+
+void bm_copy(benchmark::State& state, position pos)
+{
+    run(state, make_selection(state, pos), ewig::copy);
+}
+
+void bm_selected_text(benchmark::State& state, position pos)
+{
+    run(state, make_selection(state, pos), ewig::selected_text);
+}
+
+void bm_undo(benchmark::State& state, position pos)
+{
+    auto buf = make_buffer(state, pos);
+    buf = ewig::record(buf, ewig::insert_char(buf, L'x')).first;
+    run(state, buf, ewig::undo);
+}
+
+void bm_line_char(benchmark::State& state, position pos)
+{
+    run(state, make_buffer(state, pos), [] (const auto& buf) {
+        return ewig::line_char(buf.content[buf.cursor.row], buf.cursor.col);
+    });
+}
+
+void bm_expand_tabs(benchmark::State& state, position pos)
+{
+    run(state, make_buffer(state, pos), [] (const auto& buf) {
+        return ewig::expand_tabs(buf.content[buf.cursor.row], buf.cursor.col);
+    });
+}
+
+void register_benchmarks()
+{
+    using bm_fn = void (*) (benchmark::State&, position);
+    const std::pair<const char*, bm_fn> benchmarks[] = {
+        {"insert_char",     bm_insert_char},
+        {"delete_char",     bm_delete_char},
+        {"insert_new_line", bm_insert_new_line},
+        {"insert_text",     bm_insert_text},
+        {"cut",             bm_cut},
+        {"copy",            bm_copy},
+        {"selected_text",   bm_selected_text},
+        {"undo",            bm_undo},
+        {"line_char",       bm_line_char},
+        {"expand_tabs",     bm_expand_tabs},
+    };
+    const std::pair<const char*, position> positions[] = {
+        {"start",  position::start},
+        {"middle", position::middle},
+        {"end",    position::end},
+    };
+    auto max = max_bytes();
+    // all the benchmarks run on the same text before moving to the
+    // next one, so that each text is only built once
+    for (auto size : all_sizes) {
+        if (size > max)
+            break;
+        for (auto length : line_lengths) {
+            for (auto [name, fn] : benchmarks) {
+                for (auto [pos_name, pos] : positions) {
+                    benchmark::RegisterBenchmark(
+                        (std::string{name} + "/" + pos_name).c_str(), fn, pos)
+                        ->Args({size, length})
+                        ->ArgNames({"bytes", "line"});
+                }
+            }
+        }
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    try {
+        register_benchmarks();
+    } catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
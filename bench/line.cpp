@@ -0,0 +1,131 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Compares finding characters and columns in long lines by walking
+// them from the start, as it used to be done, with the cached line
+// index.  Lines are as long as minified code or CSV exports can get.
+
+#include <ewig/buffer.hpp>
+#include <ewig/line_index.hpp>
+
+#include <benchmark/benchmark.h>
+#include <utf8.h>
+
+#include <random>
+#include <string>
+
+namespace {
+
+// Generates a line of `length` code points.  A `non_ascii` fraction of
+// them are multi-byte code points and a `tabs` fraction are tabs.
+ewig::line make_line(std::size_t length, double non_ascii, double tabs)
+{
+    auto rng  = std::mt19937{42};
+    auto coin = std::uniform_real_distribution<double>{0, 1};
+    auto str  = std::string{};
+    for (auto n = length; n > 0; --n) {
+        auto x = coin(rng);
+        if (x < non_ascii)
+            utf8::append(0x00e0 + rng() % 0x2000, std::back_inserter(str));
+        else if (x < non_ascii + tabs)
+            str.push_back('\t');
+        else
+            str.push_back('a' + rng() % 26);
+    }
+    return {str.begin(), str.end()};
+}
+
+std::size_t walk_line_char(const ewig::line& ln, ewig::index col)
+{
+    auto fst = ln.begin();
+    auto lst = ln.end();
+    while (col --> 0 && fst != lst)
+        utf8::unchecked::next(fst);
+    return fst.index();
+}
+
+ewig::index walk_expand_tabs(const ewig::line& ln, ewig::index col)
+{
+    auto cur_col = ewig::index{};
+    for (auto c : ewig::line_range(ln)) {
+        if (col-- <= 0) break;
+        if (c == '\t') {
+            cur_col += ewig::tab_width - (cur_col % ewig::tab_width);
+        } else
+            ++cur_col;
+    }
+    return cur_col;
+}
+
+// Moves the cursor one character at a time over the first 1000
+// characters past the middle of the line, looking up the character
+// and the display column, as moving right and drawing do.
+template <typename CharFn, typename TabsFn>
+void move_right(benchmark::State& state, double non_ascii, double tabs,
+                CharFn char_fn, TabsFn tabs_fn)
+{
+    auto ln    = make_line(state.range(0), non_ascii, tabs);
+    auto first = ewig::index(state.range(0) / 2);
+    for (auto _ : state) {
+        auto count = std::size_t{};
+        for (auto col = first; col < first + 1000; ++col)
+            count += char_fn(ln, col) + tabs_fn(ln, col);
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+
+void bm_move_right_walk(benchmark::State& state, double non_ascii, double tabs)
+{
+    move_right(state, non_ascii, tabs, walk_line_char, walk_expand_tabs);
+}
+
+void bm_move_right_index(benchmark::State& state, double non_ascii, double tabs)
+{
+    move_right(state, non_ascii, tabs, ewig::line_char, ewig::expand_tabs);
+}
+
+// Cost of indexing a line that was just modified, which happens once
+// per edit of a long line.
+void bm_index_build(benchmark::State& state, double non_ascii, double tabs)
+{
+    auto ln = make_line(state.range(0), non_ascii, tabs);
+    for (auto _ : state) {
+        ln = ln.push_back('a');
+        benchmark::DoNotOptimize(ewig::get_line_index(ln));
+        ln = ln.take(ln.size() - 1);
+    }
+    state.SetBytesProcessed(state.iterations() * ln.size());
+}
+
+} // anonymous namespace
+
+BENCHMARK_CAPTURE(bm_move_right_walk, ascii, 0.0, 0.0)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_move_right_index, ascii, 0.0, 0.0)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_move_right_walk, tabs, 0.0, 0.1)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_move_right_index, tabs, 0.0, 0.1)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_move_right_walk, mixed, 0.1, 0.0)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_move_right_index, mixed, 0.1, 0.0)->Arg(10000)->Arg(100000);
+
+BENCHMARK_CAPTURE(bm_index_build, ascii, 0.0, 0.0)->Arg(10000)->Arg(100000);
+BENCHMARK_CAPTURE(bm_index_build, mixed, 0.1, 0.0)->Arg(10000)->Arg(100000);
+
+BENCHMARK_MAIN();
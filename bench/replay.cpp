@@ -0,0 +1,255 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Replays a script of commands against `ewig::update()` on a loaded
+// file, without a terminal, and reports how long each command took.
+// Scripts have one command per line, optionally preceded by how many
+// times to repeat it and followed by its argument:
+//
+//     # comments and blank lines are ignored
+//     move-end-buffer
+//     100 insert-text hello world
+//     1000 undo
+//
+// Only the state changes are measured: the effects of the commands are
+// not run, so `save` or `quit` do nothing but update the state.
+
+#include <ewig/application.hpp>
+#include <ewig/mapped_file.hpp>
+#include <ewig/scan.hpp>
+
+#include <immer/flex_vector_transient.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/resource.h>
+}
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+struct script_step
+{
+    std::size_t line;
+    std::size_t count;
+    ewig::command_action action;
+};
+
+struct options
+{
+    std::string corpus;
+    std::string script;
+    std::size_t repeat = 1;
+};
+
+options parse_options(int argc, const char** argv)
+{
+    auto opts = options{};
+    auto files = std::vector<std::string>{};
+    for (auto i = 1; i < argc; ++i) {
+        auto arg = std::string{argv[i]};
+        if (arg.rfind("--repeat=", 0) == 0) {
+            auto value = arg.substr(9);
+            if (value.empty() ||
+                value.find_first_not_of("0123456789") != std::string::npos)
+                throw std::runtime_error{"invalid repeat count: " + value};
+            opts.repeat = std::stoul(value);
+        } else if (arg.rfind("--", 0) == 0) {
+            throw std::runtime_error{"unknown option: " + arg};
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2)
+        throw std::runtime_error{"give me a corpus and a script"};
+    opts.corpus = files[0];
+    opts.script = files[1];
+    return opts;
+}
+
+std::vector<script_step> read_script(const std::string& fname)
+{
+    auto file = std::ifstream{fname};
+    if (!file)
+        throw std::runtime_error{"can't open script: " + fname};
+    auto steps = std::vector<script_step>{};
+    auto str = std::string{};
+    for (auto line = std::size_t{1}; std::getline(file, str); ++line) {
+        auto pos = str.find_first_not_of(" \t");
+        if (pos == std::string::npos || str[pos] == '#')
+            continue;
+        auto next_word = [&] {
+            auto end  = std::min(str.find_first_of(" \t", pos), str.size());
+            auto word = str.substr(pos, end - pos);
+            pos = std::min(str.find_first_not_of(" \t", end), str.size());
+            return word;
+        };
+        auto count = std::size_t{1};
+        auto name  = next_word();
+        if (name.find_first_not_of("0123456789") == std::string::npos) {
+            count = std::stoul(name);
+            name  = next_word();
+        }
+        auto id = ewig::find_command(name);
+        if (id == ewig::no_command)
+            throw std::runtime_error{fname + ":" + std::to_string(line) +
+                                     ": unknown command: " + name};
+        auto arg = pos < str.size()
+            ? ewig::arg_t{str.substr(pos)}
+            : ewig::arg_t{ewig::none_t{}};
+        steps.push_back({line, count, {name, arg, id}});
+    }
+    return steps;
+}
+
+// Loads the whole file in memory, one line at a time.  The loader of
+// the editor is not used because it runs as an effect on the event
+// loop, and no effects are run here.  Unlike it, this never opens the
+// file as a read-only view and does not replace invalid UTF-8, so the
+// text is the same whatever the size of the file.
+ewig::text read_corpus(const std::string& fname)
+{
+    auto file    = ewig::mapped_file{fname};
+    auto content = ewig::text{}.transient();
+    auto first   = file.begin();
+    auto last    = file.end();
+    while (first != last) {
+        auto eol = ewig::find_newline(first, last);
+        content.push_back({first, eol});
+        first = eol == last ? last : eol + 1;
+    }
+    return content.persistent();
+}
+
+double to_us(bench_clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+// Nearest rank percentile of sorted `samples`
+double percentile(const std::vector<double>& samples, double p)
+{
+    auto rank = std::size_t(p / 100 * samples.size());
+    return samples[std::min(rank, samples.size() - 1)];
+}
+
+void print_row(const std::string& name, std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-24s %10zu %10.1f %10.1f %10.1f %10.1f\n",
+                name.c_str(), samples.size(),
+                percentile(samples, 50),
+                percentile(samples, 90),
+                percentile(samples, 99),
+                samples.back());
+}
+
+std::size_t peak_rss_kib()
+{
+    auto usage = rusage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void run(const options& opts)
+{
+    auto steps = read_script(opts.script);
+
+    auto t0  = bench_clock::now();
+    auto txt = read_corpus(opts.corpus);
+    auto app = ewig::application{{50, 160}, ewig::make_key_map({})};
+    app = ewig::update(app, ewig::buffer_action{ewig::load_done_action{
+                ewig::existing_file{opts.corpus, txt}}}).first;
+    std::printf("corpus: %s, %zu lines, loaded in %.1f ms\n",
+                opts.corpus.c_str(), txt.size(),
+                to_us(bench_clock::now() - t0) / 1000);
+
+    auto samples = std::map<std::string, std::vector<double>>{};
+    auto all     = std::vector<double>{};
+    auto total   = bench_clock::duration{};
+    for (auto r = std::size_t{}; r < opts.repeat; ++r) {
+        for (auto& step : steps) {
+            auto& times = samples[*step.action.name];
+            for (auto n = step.count; n > 0; --n) {
+                // stamped like the terminal would, so that the history
+                // groups edits as it does in the editor
+                step.action.time_ms = ewig::action_time_ms();
+                auto start = bench_clock::now();
+                try {
+                    app = ewig::update(app, step.action).first;
+                } catch (const std::exception& err) {
+                    throw std::runtime_error{
+                        opts.script + ":" + std::to_string(step.line) +
+                        ": " + *step.action.name + ": " + err.what()};
+                }
+                auto time = bench_clock::now() - start;
+                total += time;
+                times.push_back(to_us(time));
+                all.push_back(times.back());
+            }
+        }
+    }
+    if (all.empty())
+        throw std::runtime_error{"the script has no commands"};
+
+    std::printf("%-24s %10s %10s %10s %10s %10s\n",
+                "command", "count", "p50 us", "p90 us", "p99 us", "max us");
+    for (auto& [name, times] : samples)
+        print_row(name, std::move(times));
+    auto count = all.size();
+    print_row("all", std::move(all));
+    std::printf("throughput: %.0f commands/s\n",
+                count / std::chrono::duration<double>(total).count());
+    std::printf("peak rss: %.1f MiB\n", peak_rss_kib() / 1024.);
+}
+
+} // anonymous namespace
+
+int main(int argc, const char* argv[])
+{
+    auto opts = options{};
+    try {
+        opts = parse_options(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl
+                  << "usage: " << argv[0]
+                  << " [--repeat=N] CORPUS SCRIPT" << std::endl;
+        return 1;
+    }
+
+    try {
+        run(opts);
+    } catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Compares saving through a std::ofstream, writing each chunk of the
+// lines like the editor used to do, with the gathered writes of
+// ewig::file_writer.  The `syscw` counter reports the number of write
+// system calls per save, as seen in /proc/self/io.
+//
+// ewig::file_writer always makes the save durable, writing a temporary
+// file that is synced and renamed over the target.  The ofstream is
+// run both without that, as the editor used to save, and with it, for
+// a fair comparison of the wall time.  The `durable_us` counter is the
+// time per save spent making it durable, which for the file_writer is
+// all of `commit()`, including its last batch of writes.
+
+#include <ewig/file_writer.hpp>
+
+#include <benchmark/benchmark.h>
+#include <immer/algorithm.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace {
+
+const auto file_name = std::string{"ewig-bench-save.txt"};
+const auto temp_name = std::string{".ewig-bench-save.txt.tmp"};
+
+using bench_clock = std::chrono::steady_clock;
+
+double to_us(bench_clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void fsync_path(const std::string& path, int flags)
+{
+    auto fd = ::open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0 || ::fsync(fd) < 0)
+        throw std::runtime_error{"can not sync " + path};
+    ::close(fd);
+}
+
+ewig::text make_text(std::size_t lines, std::size_t line_length)
+{
+    auto txt = ewig::text{}.transient();
+    for (auto i = std::size_t{}; i < lines; ++i) {
+        auto ln = ewig::line{}.transient();
+        for (auto j = std::size_t{}; j < line_length; ++j)
+            ln.push_back('a' + (i + j) % 26);
+        txt.push_back(ln.persistent());
+    }
+    return txt.persistent();
+}
+
+// Returns the write system calls done so far by this process, or zero
+// when the information is not available.
+double write_syscalls()
+{
+    auto io   = std::ifstream{"/proc/self/io"};
+    auto key  = std::string{};
+    auto val  = 0.0;
+    while (io >> key >> val)
+        if (key == "syscw:")
+            return val;
+    return 0;
+}
+
+// With `durable`, does what ewig::file_writer does to make the save
+// durable: writes a temporary file, syncs it, renames it over the
+// target and syncs the directory.
+void bm_save_ofstream(benchmark::State& state)
+{
+    auto content = make_text(state.range(0), state.range(1));
+    auto durable = state.range(2) != 0;
+    auto calls   = 0.0;
+    auto synced  = bench_clock::duration{};
+    for (auto _ : state) {
+        auto before = write_syscalls();
+        auto file   = std::ofstream{durable ? temp_name : file_name};
+        file.exceptions(std::fstream::badbit | std::fstream::failbit);
+        immer::for_each(content, [&] (auto l) {
+            immer::for_each_chunk(l, [&] (auto first, auto last) {
+                file.write(first, last - first);
+            });
+            file.put('\n');
+        });
+        file.close();
+        calls += write_syscalls() - before;
+        if (durable) {
+            auto start = bench_clock::now();
+            fsync_path(temp_name, O_WRONLY);
+            if (std::rename(temp_name.c_str(), file_name.c_str()) != 0)
+                throw std::runtime_error{"can not rename " + temp_name};
+            fsync_path(".", O_RDONLY | O_DIRECTORY);
+            synced += bench_clock::now() - start;
+        }
+    }
+    state.counters["syscw"] = calls / state.iterations();
+    state.counters["durable_us"] = to_us(synced) / state.iterations();
+    state.SetBytesProcessed(state.iterations() *
+                            state.range(0) * (state.range(1) + 1));
+    std::remove(file_name.c_str());
+}
+
+void bm_save_file_writer(benchmark::State& state)
+{
+    auto content = make_text(state.range(0), state.range(1));
+    auto calls   = 0.0;
+    auto synced  = bench_clock::duration{};
+    for (auto _ : state) {
+        auto before = write_syscalls();
+        auto file   = ewig::file_writer{file_name};
+        immer::for_each(content, [&] (auto&& l) { file.write(l); });
+        auto start  = bench_clock::now();
+        file.commit();
+        synced += bench_clock::now() - start;
+        calls += write_syscalls() - before;
+    }
+    state.counters["syscw"] = calls / state.iterations();
+    state.counters["durable_us"] = to_us(synced) / state.iterations();
+    state.SetBytesProcessed(state.iterations() *
+                            state.range(0) * (state.range(1) + 1));
+    std::remove(file_name.c_str());
+}
+
+} // anonymous namespace
+
+BENCHMARK(bm_save_ofstream)
+    ->ArgNames({"lines", "length", "durable"})
+    ->Args({1 << 16, 16, 0})->Args({1 << 16, 80, 0})->Args({1 << 12, 4096, 0})
+    ->Args({1 << 16, 16, 1})->Args({1 << 16, 80, 1})->Args({1 << 12, 4096, 1});
+BENCHMARK(bm_save_file_writer)
+    ->ArgNames({"lines", "length"})
+    ->Args({1 << 16, 16})->Args({1 << 16, 80})->Args({1 << 12, 4096});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,142 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Compares the block based newline and utf-8 scanning used by the
+// loader with its previous per-line paths.  `bm_getline_replace_invalid`
+// is how files were first loaded, splitting lines with std::getline and
+// sanitizing each of them with utf8::replace_invalid.
+// `bm_memchr_find_invalid` is how they were loaded once mapped in
+// memory, splitting lines with memchr and only checking them with
+// utf8::find_invalid.
+
+#include <ewig/scan.hpp>
+
+#include <benchmark/benchmark.h>
+#include <utf8.h>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// Generates about `size` bytes of lines of average length
+// `line_length`.  A `non_ascii` fraction of the characters are
+// multi-byte code points.
+std::string make_input(std::size_t size, std::size_t line_length,
+                       double non_ascii)
+{
+    auto rng  = std::mt19937{42};
+    auto coin = std::bernoulli_distribution{non_ascii};
+    auto len  = std::uniform_int_distribution<std::size_t>{0, 2 * line_length};
+    auto str  = std::string{};
+    str.reserve(size + 2 * line_length);
+    while (str.size() < size) {
+        for (auto n = len(rng); n > 0; --n) {
+            if (coin(rng))
+                utf8::append(0x00e0 + rng() % 0x2000, std::back_inserter(str));
+            else
+                str.push_back('a' + rng() % 26);
+        }
+        str.push_back('\n');
+    }
+    return str;
+}
+
+const auto input_size = std::size_t{1} << 24;
+
+void bm_getline_replace_invalid(benchmark::State& state, double non_ascii)
+{
+    auto input = make_input(input_size, state.range(0), non_ascii);
+    for (auto _ : state) {
+        auto stream = std::istringstream{input};
+        auto ln1    = std::string{};
+        auto ln2    = std::string{};
+        auto count  = std::size_t{};
+        while (std::getline(stream, ln1)) {
+            ln2.clear();
+            utf8::replace_invalid(ln1.begin(), ln1.end(),
+                                  std::back_inserter(ln2));
+            count += ln2.size();
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void bm_memchr_find_invalid(benchmark::State& state, double non_ascii)
+{
+    auto input = make_input(input_size, state.range(0), non_ascii);
+    for (auto _ : state) {
+        auto first = static_cast<const char*>(input.data());
+        auto last  = input.data() + input.size();
+        auto count = std::size_t{};
+        while (first != last) {
+            auto eol = static_cast<const char*>(
+                std::memchr(first, '\n', last - first));
+            if (!eol) eol = last;
+            count += utf8::find_invalid(first, eol) == eol;
+            first = eol == last ? last : eol + 1;
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void bm_scan_blocks(benchmark::State& state, double non_ascii)
+{
+    constexpr auto block_size = std::size_t{1} << 16;
+    auto input = make_input(input_size, state.range(0), non_ascii);
+    for (auto _ : state) {
+        auto first = static_cast<const char*>(input.data());
+        auto last  = input.data() + input.size();
+        auto count = std::size_t{};
+        while (first != last) {
+            auto block = first + std::min(block_size, std::size_t(last - first));
+            if (block != last) {
+                block = ewig::find_newline(block, last);
+                block = block == last ? last : block + 1;
+            }
+            count += ewig::is_valid_utf8(first, block);
+            while (first != block) {
+                auto eol = ewig::find_newline(first, block);
+                first = eol == block ? block : eol + 1;
+                ++count;
+            }
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+} // anonymous namespace
+
+BENCHMARK_CAPTURE(bm_getline_replace_invalid, ascii, 0.0)->Arg(16)->Arg(80)->Arg(1000);
+BENCHMARK_CAPTURE(bm_memchr_find_invalid, ascii, 0.0)->Arg(16)->Arg(80)->Arg(1000);
+BENCHMARK_CAPTURE(bm_scan_blocks, ascii, 0.0)->Arg(16)->Arg(80)->Arg(1000);
+
+BENCHMARK_CAPTURE(bm_getline_replace_invalid, mixed, 0.1)->Arg(16)->Arg(80)->Arg(1000);
+BENCHMARK_CAPTURE(bm_memchr_find_invalid, mixed, 0.1)->Arg(16)->Arg(80)->Arg(1000);
+BENCHMARK_CAPTURE(bm_scan_blocks, mixed, 0.1)->Arg(16)->Arg(80)->Arg(1000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,156 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+// Compares the output of drawing through ncurses with the direct VT100
+// screen, for some typical changes from one frame to the next.  The
+// `bytes` and `writes` counters are per frame.  Both write to
+// /dev/null, ncurses emulating an xterm.
+
+#include <ewig/draw.hpp>
+
+#include <benchmark/benchmark.h>
+#include <immer/flex_vector_transient.hpp>
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+
+extern "C" {
+
+#ifndef _XOPEN_SOURCE_EXTENDED
+    #define _XOPEN_SOURCE_EXTENDED
+#endif
+
+#include <fcntl.h>
+#include <ncurses.h>
+#include <unistd.h>
+}
+
+namespace {
+
+const auto window_size = ewig::coord{50, 160};
+
+ewig::text make_text(std::size_t lines, std::size_t line_length)
+{
+    auto txt = ewig::text{}.transient();
+    for (auto i = std::size_t{}; i < lines; ++i) {
+        auto ln = ewig::line{}.transient();
+        for (auto j = std::size_t{}; j < line_length; ++j)
+            ln.push_back((i + j) % 7 ? 'a' + (i * j) % 26 : ' ');
+        txt.push_back(ln.persistent());
+    }
+    return txt.persistent();
+}
+
+ewig::application make_application()
+{
+    auto app = ewig::application{window_size, ewig::make_key_map({})};
+    app.current.content = make_text(1000, 120);
+    return app;
+}
+
+// Sets up ncurses once, writing to /dev/null
+void init_ncurses()
+{
+    static auto term = [] {
+        auto out  = std::fopen("/dev/null", "w");
+        auto in   = std::fopen("/dev/null", "r");
+        auto term = ::newterm("xterm-256color", out, in);
+        if (!term)
+            throw std::runtime_error{"could not initialize ncurses"};
+        ::resizeterm(window_size.row, window_size.col);
+        ::refresh();
+        return term;
+    }();
+    (void) term;
+}
+
+std::unique_ptr<ewig::screen> make_screen(bool vt100)
+{
+    static auto null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (vt100)
+        return ewig::make_vt100_screen(null_fd);
+    init_ncurses();
+    return ewig::make_ncurses_screen(true);
+}
+
+template <typename Fn>
+void bm_frames(benchmark::State& state, bool vt100, Fn next_frame)
+{
+    auto scr = make_screen(vt100);
+    auto app = make_application();
+    ewig::draw(*scr, app);
+    auto before = scr->stats();
+    for (auto _ : state) {
+        app = next_frame(app);
+        ewig::draw(*scr, app);
+    }
+    auto after  = scr->stats();
+    auto frames = double(std::max(after.frames - before.frames, std::size_t{1}));
+    state.counters["bytes"]  = (after.bytes - before.bytes) / frames;
+    state.counters["writes"] = (after.writes - before.writes) / frames;
+}
+
+ewig::application move_cursor(ewig::application app)
+{
+    app.current = ewig::move_cursor_right(app.current);
+    return app;
+}
+
+ewig::application type_char(ewig::application app)
+{
+    return ewig::apply_edit(
+        app, ewig::insert_char(app.current, L'a' + app.current.cursor.col % 26));
+}
+
+ewig::application scroll_line(ewig::application app)
+{
+    auto& buf = app.current;
+    buf.scroll.row = (buf.scroll.row + 1) % 900;
+    buf.cursor.row = buf.scroll.row;
+    return app;
+}
+
+void bm_move_cursor(benchmark::State& state, bool vt100)
+{
+    bm_frames(state, vt100, move_cursor);
+}
+
+void bm_type_char(benchmark::State& state, bool vt100)
+{
+    bm_frames(state, vt100, type_char);
+}
+
+void bm_scroll_line(benchmark::State& state, bool vt100)
+{
+    bm_frames(state, vt100, scroll_line);
+}
+
+} // anonymous namespace
+
+BENCHMARK_CAPTURE(bm_move_cursor, ncurses, false);
+BENCHMARK_CAPTURE(bm_move_cursor, vt100, true);
+BENCHMARK_CAPTURE(bm_type_char, ncurses, false);
+BENCHMARK_CAPTURE(bm_type_char, vt100, true);
+BENCHMARK_CAPTURE(bm_scroll_line, ncurses, false);
+BENCHMARK_CAPTURE(bm_scroll_line, vt100, true);
+
+BENCHMARK_MAIN();
@@ -20,6 +20,7 @@ stdenv.mkDerivation rec {
     cmake
     ncurses
     boost
+    gbenchmark
     deps.immer
     deps.scelta
     deps.utfcpp
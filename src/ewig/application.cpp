@@ -19,8 +19,16 @@
 //
 
 #include "ewig/application.hpp"
+#include "ewig/stats.hpp"
+#include "ewig/trace.hpp"
 
 #include <scelta.hpp>
+#include <utf8.h>
+
+#include <chrono>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 using namespace std::string_literals;
 
@@ -66,6 +74,19 @@ command app_command(Fn fn)
     };
 }
 
+// Like app_command<std::string>, but `fallback` is passed when there is
+// no argument, as when the command comes from the key map
+template <typename Fn>
+command app_command_or(std::string fallback, Fn fn)
+{
+    return [=] (application state, arg_t x) {
+        const auto& str = std::holds_alternative<none_t>(x)
+            ? fallback
+            : std::get<std::string>(x);
+        return std::pair{fn(state, str), lager::noop};
+    };
+}
+
 template <typename Arg=void, typename Fn>
 command edit_command(Fn fn)
 {
@@ -75,6 +96,18 @@ command edit_command(Fn fn)
     };
 }
 
+// Like edit_command, but consecutive edits of the same kind get grouped
+// into a single undo step, see `record()`
+template <typename Arg=void, typename Fn>
+command typing_command(edit_kind kind, Fn fn)
+{
+    return [=] (application state, arg_t x) {
+        return std::pair{apply_edit(state, arg<Arg>::invoke(fn, x, state.current),
+                                    kind),
+                lager::noop};
+    };
+}
+
 template <typename Arg=void, typename Fn>
 command paste_command(Fn fn)
 {
@@ -100,41 +133,121 @@ command scroll_command(Fn fn)
     };
 }
 
+// Wraps a command that modifies the buffer content, so it is refused
+// when the buffer is a read-only view.
+command writable(command cmd)
+{
+    return [=] (application state, arg_t x) {
+        return is_read_only(state.current)
+            ? std::pair{put_message(state, "buffer is read-only"),
+                        lager::effect<action>{lager::noop}}
+            : cmd(state, x);
+    };
+}
+
+// Wraps a command that needs to know how many lines there are, so it
+// is refused while they are being counted, as with a new view.
+command counted(command cmd)
+{
+    return [=] (application state, arg_t x) {
+        return !line_count(state.current)
+            ? std::pair{put_message(state, "still counting lines, try again later"),
+                        lager::effect<action>{lager::noop}}
+            : cmd(state, x);
+    };
+}
+
+buffer insert_string(buffer buf, const std::string& str)
+{
+    return insert_text(buf, text{line{str.begin(), str.end()}});
+}
+
+// Whether the key for `c` has to go through the key map, either
+// because it is part of a key sequence or because it is bound.
+bool needs_key_map(const application& state, wchar_t c)
+{
+    return state.input != key_map_root
+        || next_key_node(state.keys, key_map_root, {0, c}) != key_map_none;
+}
+
 } // anonymous namespace
 
-using commands = std::unordered_map<std::string, command>;
+struct named_command
+{
+    std::string name;
+    command fn;
+};
 
-static const auto global_commands = commands
+// The position of a command in this table is its `command_id`
+static const auto global_commands = std::vector<named_command>
 {
-    {"insert",                 edit_command<wchar_t>(insert_char)},
-    {"delete-char",            edit_command(delete_char)},
-    {"delete-char-right",      edit_command(delete_char_right)},
-    {"insert-tab",             edit_command(insert_tab)},
-    {"kill-line",              edit_command(cut_rest)},
+    {"insert",                 writable(typing_command<wchar_t>(edit_kind::insert, insert_char))},
+    {"delete-char",            writable(typing_command(edit_kind::erase, delete_char))},
+    {"delete-char-right",      writable(typing_command(edit_kind::erase, delete_char_right))},
+    {"insert-text",            writable(typing_command<std::string>(edit_kind::insert, insert_string))},
+    {"insert-tab",             writable(edit_command(insert_tab))},
+    {"kill-line",              writable(edit_command(cut_rest))},
     {"copy",                   edit_command(copy)},
-    {"cut",                    edit_command(cut)},
+    {"cut",                    writable(edit_command(cut))},
     {"move-beginning-of-line", edit_command(move_line_start)},
     {"move-beginning-buffer",  edit_command(move_buffer_start)},
-    {"move-end-buffer",        edit_command(move_buffer_end)},
+    {"move-end-buffer",        counted(edit_command(move_buffer_end))},
     {"move-down",              edit_command(move_cursor_down)},
     {"move-end-of-line",       edit_command(move_line_end)},
     {"move-left",              edit_command(move_cursor_left)},
     {"move-right",             edit_command(move_cursor_right)},
     {"move-up",                edit_command(move_cursor_up)},
-    {"new-line",               edit_command(insert_new_line)},
+    {"new-line",               writable(edit_command(insert_new_line))},
     {"page-down",              scroll_command(page_down)},
     {"page-up",                scroll_command(page_up)},
-    {"paste",                  paste_command(insert_text)},
+    {"paste",                  writable(paste_command(insert_text))},
     {"quit",                   app_command_with_effect(quit)},
     {"save",                   app_command_with_effect(save)},
     {"load",                   app_command_with_effect<std::string>(load)},
     {"message",                app_command<std::string>(put_message)},
     {"undo",                   edit_command(undo)},
+    {"redo",                   edit_command(redo)},
+    {"undo-branch",            edit_command(undo_branch)},
+    {"undo-to-time",           app_command_or("60", undo_seconds)},
+    {"history-memory",         app_command(show_history_memory)},
+    {"set-history-budget",     app_command_or(std::to_string(default_history_budget >> 20),
+                                              change_history_budget)},
     {"start-selection",        edit_command(start_selection)},
-    {"select-whole-buffer",    edit_command(select_whole_buffer)},
+    {"select-whole-buffer",    counted(edit_command(select_whole_buffer))},
+    {"echo-commands",          app_command(toggle_echo_commands)},
+    {"stats",                  app_command(show_stats)},
+    {"set-message-log-size",   app_command<std::string>(change_message_log_size)},
     {"noop",                   [](auto app, auto...){ return std::pair{app, lager::noop}; }},
 };
 
+std::int64_t action_time_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+command_id find_command(const std::string& name)
+{
+    static const auto index = [] {
+        auto result = std::unordered_map<std::string, command_id>{};
+        for (auto id = command_id{}; id < global_commands.size(); ++id)
+            result.emplace(global_commands[id].name, id);
+        return result;
+    }();
+    auto it = index.find(name);
+    return it != index.end() ? it->second : no_command;
+}
+
+key_map resolve_commands(key_map map)
+{
+    return map.update([] (auto nodes) {
+        for (auto& node : nodes)
+            if (!node.command->empty())
+                node.id = find_command(node.command);
+        return nodes;
+    });
+}
+
 std::pair<application, lager::effect<action>> quit(application app)
 {
     return {
@@ -172,12 +285,64 @@ std::pair<application, lager::effect<action>> load(application state, const std:
 application put_message(application state, immer::box<std::string> str)
 {
     if (!str->empty()) {
-        state.messages = std::move(state.messages)
-            .push_back({std::time(nullptr), std::move(str)});
+        state.messages = push_message(std::move(state.messages),
+                                      {std::time(nullptr), std::move(str)});
     }
     return state;
 }
 
+application show_history_memory(application state)
+{
+    const auto& buf = state.current;
+    return put_message(state,
+                       "history: "s + std::to_string(buf.history.size())
+                       + " states retaining "
+                       + std::to_string(buf.history_bytes >> 10) + " KiB of "
+                       + std::to_string(buf.history_budget >> 10) + " KiB");
+}
+
+application change_history_budget(application state, const std::string& mib)
+{
+    if (mib.empty() || mib.size() > 9 ||
+        mib.find_first_not_of("0123456789") != std::string::npos)
+        return put_message(state, "invalid history budget: "s + mib);
+    state.current = set_history_budget(state.current, std::stoul(mib) << 20);
+    return show_history_memory(state);
+}
+
+application undo_seconds(application state, const std::string& secs)
+{
+    if (secs.empty() || secs.size() > 9 ||
+        secs.find_first_not_of("0123456789") != std::string::npos)
+        return put_message(state, "invalid number of seconds: "s + secs);
+    return apply_edit(state, undo_to_time(state.current,
+                                          state.time_ms
+                                          - std::stol(secs) * 1000));
+}
+
+application toggle_echo_commands(application state)
+{
+    state.echo_commands = !state.echo_commands;
+    return put_message(state, state.echo_commands
+                       ? "echoing commands"
+                       : "not echoing commands");
+}
+
+application show_stats(application state)
+{
+    return put_message(state, stats_summary(global_stats()));
+}
+
+application change_message_log_size(application state, const std::string& size)
+{
+    if (size.empty() || size.size() > 9 ||
+        size.find_first_not_of("0123456789") != std::string::npos ||
+        std::stoul(size) == 0)
+        return put_message(state, "invalid message log size: "s + size);
+    state.messages = set_message_log_capacity(state.messages, std::stoul(size));
+    return put_message(state, "keeping the last "s + size + " messages");
+}
+
 coord editor_size(application app)
 {
     return {app.window_size.row - 2, app.window_size.col};
@@ -185,21 +350,29 @@ coord editor_size(application app)
 
 application clear_input(application state)
 {
-    state.input = {};
+    state.input = key_map_root;
     return state;
 }
 
-std::pair<application, lager::effect<action>> update(application state, action ev)
+namespace {
+
+std::pair<application, lager::effect<action>> update_application(application state, action ev)
 {
     using result_t = std::pair<application, lager::effect<action>>;
 
     return scelta::match(
         [&](const command_action& ev) -> result_t
         {
-            auto it = global_commands.find(ev.name);
-            if (it != global_commands.end()) {
-                state = put_message(state, "calling command: "s + *ev.name);
-                return it->second(state, ev.arg);
+            auto id = ev.id < global_commands.size() ? ev.id : find_command(ev.name);
+            if (id != no_command) {
+                if (state.echo_commands)
+                    state = put_message(state, "calling command: "s + *ev.name);
+                const auto& cmd = global_commands[id];
+                auto timer = stats_timer{
+                    get_command_stats(global_stats(), id, cmd.name.c_str())};
+                auto span  = trace_span{cmd.name.c_str(), "command"};
+                state.time_ms = ev.time_ms;
+                return cmd.fn(state, ev.arg);
             } else {
                 return {put_message(state, "unknown command: "s + *ev.name),
                         lager::noop};
@@ -211,6 +384,42 @@ std::pair<application, lager::effect<action>> update(application state, action e
             state.current = buffer;
             return {put_message(state, msg), lager::noop};
         },
+        [&](const text_action& ev) -> result_t
+        {
+            // a run of typed or pasted characters is inserted at once,
+            // but the ones that mean something else go through the key
+            // map right here, so that everything keeps its order
+            static const auto insert_text_id = find_command("insert-text");
+            auto effects = std::vector<lager::effect<action>>{};
+            auto pending = std::string{};
+            auto flush   = [&] {
+                if (!pending.empty()) {
+                    effects.push_back([str = pending, time = ev.time_ms] (auto ctx) {
+                        ctx.dispatch(command_action{"insert-text", str,
+                                                    insert_text_id, time});
+                    });
+                    pending.clear();
+                }
+            };
+            for (auto it = ev.text->begin(); it != ev.text->end();) {
+                auto first = it;
+                auto c = (wchar_t) utf8::unchecked::next(it);
+                if (needs_key_map(state, c)) {
+                    flush();
+                    auto [next, eff] = update_application(
+                        state, key_action{{0, c}, ev.time_ms});
+                    state = next;
+                    effects.push_back(eff);
+                } else {
+                    pending.append(first, it);
+                }
+            }
+            flush();
+            return {state, [effects] (auto ctx) {
+                for (auto& eff : effects)
+                    eff(ctx);
+            }};
+        },
         [&](const resize_action& ev) -> result_t
         {
             state.window_size = ev.size;
@@ -224,24 +433,25 @@ std::pair<application, lager::effect<action>> update(application state, action e
                 // key-map?
                 return {clear_input(put_message(state, "cancel")), lager::noop};
             } else {
-                state.input = state.input.push_back(ev.key);
-                const auto& map = state.keys.get();
-                auto it = map.find(state.input);
-                if (it != map.end()) {
-                    if (!it->second->empty()) {
-                        auto cmd = it->second;
-                        return {clear_input(state), [cmd] (auto ctx) {
-                            ctx.dispatch(command_action{cmd, {}});
+                auto is_single_char = state.input == key_map_root;
+                state.input = next_key_node(state.keys, state.input, ev.key);
+                if (state.input != key_map_none) {
+                    const auto& node = (*state.keys)[state.input];
+                    if (!node.command->empty()) {
+                        auto cmd = node.command;
+                        auto id  = node.id;
+                        return {clear_input(state), [cmd, id, time = ev.time_ms] (auto ctx) {
+                            ctx.dispatch(command_action{cmd, {}, id, time});
                         }};
                     }
                 } else if (key_seq{ev.key} != key::ctrl('[')) {
                     using std::get;
-                    auto is_single_char = state.input.size() == 1;
                     auto [kres, kkey] = ev.key;
                     if (is_single_char && !kres && !std::iscntrl(kkey)) {
+                        static const auto insert_id = find_command("insert");
                         auto key = (wchar_t)kkey;
-                        return {clear_input(state), [key] (auto ctx) {
-                            ctx.dispatch(command_action{"insert", key});
+                        return {clear_input(state), [key, time = ev.time_ms] (auto ctx) {
+                            ctx.dispatch(command_action{"insert", key, insert_id, time});
                         }};
                     } else {
                         return {clear_input(put_message(state, "unbound key sequence")),
@@ -253,11 +463,30 @@ std::pair<application, lager::effect<action>> update(application state, action e
         })(ev);
 }
 
-application apply_edit(application state, buffer edit)
+} // anonymous namespace
+
+std::pair<application, lager::effect<action>> update(application state, action ev)
+{
+    auto timer = stats_timer{global_stats().update};
+    auto span  = trace_span{"update"};
+    auto [next, effect] = update_application(std::move(state), std::move(ev));
+    // most actions have no effect, those are returned as they are to
+    // not pay for one more function object for each of them
+    if (!effect || effect.target_type() == typeid(lager::noop))
+        return {std::move(next), std::move(effect)};
+    return {std::move(next), [effect = std::move(effect)] (auto&& ctx) {
+        auto timer = stats_timer{global_stats().effects};
+        auto span  = trace_span{"effect"};
+        effect(ctx);
+    }};
+}
+
+application apply_edit(application state, buffer edit, edit_kind kind)
 {
     auto msg = std::string{};
     std::tie(state.current, msg) =
-        record(state.current, scroll_to_cursor(edit, editor_size(state)));
+        record(state.current, scroll_to_cursor(edit, editor_size(state)),
+               kind, state.time_ms);
     return put_message(state, msg);
 }
 
@@ -265,7 +494,8 @@ application apply_edit(application state, std::pair<buffer, text> edit)
 {
     auto msg = std::string{};
     std::tie(state.current, msg) =
-        record(state.current, scroll_to_cursor(edit.first, editor_size(state)));
+        record(state.current, scroll_to_cursor(edit.first, editor_size(state)),
+               edit_kind::other, state.time_ms);
     return put_message(put_clipboard(state, edit.second), msg);
 }
 
@@ -22,10 +22,12 @@
 
 #include <ewig/keys.hpp>
 #include <ewig/buffer.hpp>
+#include <ewig/message_log.hpp>
 
 #include <lager/store.hpp>
 #include <lager/extra/cereal/struct.hpp>
 
+#include <cstdint>
 #include <ctime>
 #include <variant>
 
@@ -37,55 +39,89 @@ using arg_t = std::variant<none_t,
                           std::string,
                           wchar_t>;
 
-struct key_action { key_code key; };
+// The `time_ms` of the actions is when they were created, as returned
+// by `action_time_ms()`, so that updating stays a pure function of the
+// action, also when replaying them.
+struct key_action { key_code key; std::int64_t time_ms = 0; };
+struct text_action { immer::box<std::string> text; std::int64_t time_ms = 0; };
 struct resize_action { coord size; };
-struct command_action { immer::box<std::string> name; arg_t arg; };
+struct command_action
+{
+    immer::box<std::string> name;
+    arg_t arg;
+    // when known, saves looking up the command by name
+    command_id id = no_command;
+    std::int64_t time_ms = 0;
+};
 
 using action = std::variant<command_action,
                            key_action,
+                           text_action,
                            buffer_action,
                            resize_action>;
 
-struct message
-{
-    std::time_t time_stamp;
-    immer::box<std::string> content;
-};
-
 struct application
 {
     coord window_size;
     key_map keys;
-    key_seq input;
+    key_node_id input = key_map_root;
     buffer current;
     immer::vector<text> clipboard;
-    immer::vector<message> messages;
+    message_log messages;
+    bool echo_commands = false;
+    // time of the command being run, which edits are recorded with
+    std::int64_t time_ms = 0;
 };
 
 using command = std::function<
     std::pair<application, lager::effect<action>>(
         application, arg_t)>;
 
+/**
+ * Returns the time to stamp a new action with, in milliseconds.  It is
+ * only used for the history, so it just needs to be monotonic.
+ */
+std::int64_t action_time_ms();
+
+/**
+ * Returns the identifier of the command called `name`, or `no_command`
+ * when there is no such command.
+ */
+command_id find_command(const std::string& name);
+
+/**
+ * Returns `map` with the commands of its bindings resolved to their
+ * identifiers, so that keys do not need to look them up by name.
+ */
+key_map resolve_commands(key_map map);
+
 coord editor_size(application app);
 
 application paste(application app, coord size);
 application put_message(application state, immer::box<std::string> str);
 application put_clipboard(application state, text content);
 application clear_input(application state);
+application show_history_memory(application state);
+application change_history_budget(application state, const std::string& mib);
+application undo_seconds(application state, const std::string& secs);
+application toggle_echo_commands(application state);
+application show_stats(application state);
+application change_message_log_size(application state, const std::string& size);
 
 std::pair<application, lager::effect<action>> quit(application app);
 std::pair<application, lager::effect<action>> save(application app);
 std::pair<application, lager::effect<action>> load(application app, const std::string& fname);
 std::pair<application, lager::effect<action>> update(application state, action ev);
 
-application apply_edit(application state, coord size, buffer edit);
-application apply_edit(application state, coord size, std::pair<buffer, text> edit);
+application apply_edit(application state, buffer edit,
+                       edit_kind kind = edit_kind::other);
+application apply_edit(application state, std::pair<buffer, text> edit);
 
 } // namespace ewig
 
 LAGER_STRUCT(ewig, none_t);
-LAGER_STRUCT(ewig, key_action, key);
+LAGER_STRUCT(ewig, key_action, key, time_ms);
+LAGER_STRUCT(ewig, text_action, text, time_ms);
 LAGER_STRUCT(ewig, resize_action, size);
-LAGER_STRUCT(ewig, command_action, name, arg);
-LAGER_STRUCT(ewig, message, time_stamp, content);
-LAGER_STRUCT(ewig, application, window_size, keys, input, current, clipboard, messages);
+LAGER_STRUCT(ewig, command_action, name, arg, id, time_ms);
+LAGER_STRUCT(ewig, application, window_size, keys, input, current, clipboard, messages, echo_commands, time_ms);
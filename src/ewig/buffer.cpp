@@ -19,6 +19,12 @@
 //
 
 #include "ewig/buffer.hpp"
+#include "ewig/file_writer.hpp"
+#include "ewig/journal.hpp"
+#include "ewig/line_index.hpp"
+#include "ewig/mapped_file.hpp"
+#include "ewig/scan.hpp"
+#include "ewig/trace.hpp"
 
 #include <immer/flex_vector_transient.hpp>
 #include <immer/algorithm.hpp>
@@ -26,10 +32,12 @@
 #include <scelta.hpp>
 
 #include <algorithm>
-#include <fstream>
-#include <iostream>
+#include <atomic>
+#include <future>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace ewig {
 
@@ -49,22 +57,49 @@ std::pair<buffer, std::string> update_buffer(buffer buf, buffer_action act)
 {
     using namespace std::string_literals;
 
+    // loaded content is always in sync with the file, even when loading
+    // fails, while saves tell the version that ends up on disk
     return scelta::match(
         [&] (load_progress_action& act) {
             buf.content = act.file.content;
+            buf.version = act.file.version = ++buf.last_version;
             buf.from = act.file;
             return std::pair{buf, ""s};
         },
         [&] (load_done_action& act) {
             buf.content = act.file.content;
+            buf.version = act.file.version = ++buf.last_version;
             buf.from = act.file;
             return std::pair{buf, "loaded: "s + act.file.name.get()};
         },
+        [&] (view_done_action& act) {
+            buf.content = act.file.content;
+            buf.version = act.file.version = ++buf.last_version;
+            buf.from = act.file;
+            buf.view = act.view;
+            buf.view_lines = std::nullopt;
+            return std::pair{buf, "viewing read-only: "s + act.file.name.get()};
+        },
+        [&] (view_count_action& act) {
+            // the count of a view that was replaced already is useless
+            if (act.view == buf.view)
+                buf.view_lines = act.lines;
+            return std::pair{buf, ""s};
+        },
         [&] (load_error_action& act) {
             buf.content = act.file.content;
+            buf.version = act.file.version = ++buf.last_version;
             buf.from = act.file;
             return std::pair{buf, "error while loading: "s + act.file.name.get()};
         },
+        [&] (recover_action& act) {
+            // the file is loaded but the recovered changes are not saved
+            act.file.version = ++buf.last_version;
+            buf.content = act.content;
+            buf.version = ++buf.last_version;
+            buf.from = act.file;
+            return std::pair{buf, "recovered unsaved changes: "s + act.file.name.get()};
+        },
         [&] (save_progress_action& act) {
             buf.from = act.file;
             return std::pair{buf, ""s};
@@ -81,90 +116,236 @@ std::pair<buffer, std::string> update_buffer(buffer buf, buffer_action act)
 
 namespace {
 
-std::streamoff stream_size(std::istream& file)
+constexpr auto progress_report_rate_bytes = 1 << 20;
+
+// Files are only split for parallel loading in chunks of at least
+// this size, so small files are still loaded by a single thread.
+constexpr auto min_load_chunk_bytes = std::size_t{1} << 24;
+
+// Size of the blocks that are checked for valid utf-8 at once.
+constexpr auto scan_block_bytes = std::size_t{1} << 16;
+
+using byte_range = std::pair<const char*, const char*>;
+
+// Splits [first, last) in at most `n` ranges of similar size, placing
+// the boundaries right after a newline.
+std::vector<byte_range> split_lines(const char* first, const char* last,
+                                    std::size_t n)
 {
-    auto begp = file.tellg();
-    file.seekg(0, std::ios::end);
-    auto endp = file.tellg();
-    file.seekg(begp, std::ios::beg);
-    return endp - begp;
+    auto result = std::vector<byte_range>{};
+    auto size   = std::size_t(last - first);
+    auto start  = first;
+    for (auto i = std::size_t{1}; i < n && start != last; ++i) {
+        auto pos = std::max(first + size * i / n, start);
+        auto eol = find_newline(pos, last);
+        if (eol == last) break;
+        result.push_back({start, eol + 1});
+        start = eol + 1;
+    }
+    if (start != last)
+        result.push_back({start, last});
+    return result;
 }
 
-auto load_file_effect(immer::box<std::string> file_name)
+// Builds the lines in [first, last).  The input is processed in blocks
+// of whole lines that are validated at once and, when they are valid
+// utf-8, split and copied straight into the lines.  Only the lines of
+// blocks with invalid utf-8 get validated one by one, and the invalid
+// ones go through an intermediate buffer where the bad sequences get
+// replaced, which is signaled setting `sanitized`.  `report` is called
+// regularly with the number of bytes processed since the previous call
+// and the lines loaded so far.
+template <typename ReportFn>
+text load_lines(const char* first, const char* last,
+                std::atomic<bool>& sanitized, ReportFn&& report)
 {
-    constexpr auto progress_report_rate_bytes = 1 << 20;
+    auto content = text{}.transient();
+    auto invalid = std::string{};
+    auto lastp   = first;
+    while (first != last) {
+        auto block = first + std::min<std::size_t>(scan_block_bytes,
+                                                   last - first);
+        if (block != last) {
+            block = find_newline(block, last);
+            block = block == last ? last : block + 1;
+        }
+        auto valid = is_valid_utf8(first, block);
+        while (first != block) {
+            auto eol = find_newline(first, block);
+            if (valid || is_valid_utf8(first, eol)) {
+                content.push_back({first, eol});
+            } else {
+                sanitized = true;
+                invalid.clear();
+                utf8::replace_invalid(first, eol, std::back_inserter(invalid));
+                content.push_back({begin(invalid), end(invalid)});
+            }
+            first = eol == block ? block : eol + 1;
+        }
+        if (first - lastp > progress_report_rate_bytes) {
+            report(first - lastp, content);
+            lastp = first;
+        }
+    }
+    report(first - lastp, content);
+    return content.persistent();
+}
 
+auto load_file_effect(immer::box<std::string> file_name,
+                      std::size_t view_threshold,
+                      bool recover)
+{
     return [=] (auto& ctx) {
         ctx.loop().async([=] {
-            auto content = text{}.transient();
-            auto file = std::ifstream{};
-            file.exceptions(std::fstream::badbit | std::fstream::failbit);
+            auto span    = trace_span{"load", "io"};
+            auto content = text{};
             try {
-                file.open(file_name);
-                file.exceptions(std::fstream::badbit);
-                auto file_size = stream_size(file);
-                auto progress  = loading_file{ file_name, {}, 0, file_size };
-                auto ln1       = std::string{};
-                auto ln2       = std::string{};
-                auto lastp = progress.loaded_bytes;
-                // work-around gcc-7 bug
-                // https://www.mail-archive.com/gcc-bugs@gcc.gnu.org/msg533664.html
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-                while (std::getline(file, ln1)) {
-#pragma GCC diagnostic pop
-                    ln2.clear();
-                    utf8::replace_invalid(ln1.begin(), ln1.end(),
-                                         std::back_inserter(ln2));
-                    content.push_back({begin(ln2), end(ln2)});
-                    progress.loaded_bytes += ln1.size();
+                auto file     = mapped_file{file_name};
+                if (file.size() >= view_threshold) {
+                    auto view = text_view{std::move(file)};
+                    ctx.dispatch(view_done_action{{file_name, {}}, view});
+                    // the view can be browsed meanwhile, only going to
+                    // its end needs to wait for this
+                    auto lines = view.count();
+                    ctx.dispatch(view_count_action{view, lines});
+                    return;
+                }
+                auto progress = loading_file{
+                    file_name, {}, 0, (std::streamoff) file.size() };
+                auto loaded   = std::atomic<std::streamoff>{0};
+                auto sanitized = std::atomic<bool>{false};
+                auto lastp    = std::streamoff{0};
+                auto threads  = std::clamp<std::size_t>(
+                    file.size() / min_load_chunk_bytes, 1,
+                    std::max(std::thread::hardware_concurrency(), 1u));
+                auto ranges   = split_lines(file.begin(), file.end(), threads);
+                // the first range is loaded by this thread, which also
+                // reports the progress, the rest by workers that get
+                // joined in order, concatenating their results
+                auto workers  = std::vector<std::future<text>>{};
+                for (auto i = std::size_t{1}; i < ranges.size(); ++i) {
+                    workers.push_back(std::async(std::launch::async, [&, i] {
+                        auto span = trace_span{"load lines", "io"};
+                        return load_lines(
+                            ranges[i].first, ranges[i].second, sanitized,
+                            [&] (auto bytes, auto&) { loaded += bytes; });
+                    }));
+                }
+                auto report = [&] {
+                    progress.loaded_bytes = loaded;
                     if (progress.loaded_bytes - lastp >
                         progress_report_rate_bytes) {
-                        progress.content = content.persistent();
                         ctx.dispatch(load_progress_action{progress});
                         lastp = progress.loaded_bytes;
                     }
+                };
+                if (!ranges.empty()) {
+                    content = load_lines(
+                        ranges[0].first, ranges[0].second, sanitized,
+                        [&] (auto bytes, auto& partial) {
+                            loaded += bytes;
+                            progress.content = partial.persistent();
+                            report();
+                        });
                 }
-                ctx.dispatch(load_done_action{{file_name, content.persistent()}});
+                for (auto& worker : workers) {
+                    content = content + worker.get();
+                    progress.content = content;
+                    report();
+                }
+                // only when saving the lines gives back the same bytes
+                // can the file later be updated in place
+                auto exact  = !sanitized &&
+                    (file.size() == 0 || file.end()[-1] == '\n');
+                auto result = existing_file{
+                    file_name, content, exact ? file.stamp() : file_stamp{}};
+                // changes that were not saved before a crash are still
+                // in the journal
+                auto recovered = recover
+                    ? replay_journal(journal_path(file_name), result.stamp, content)
+                    : std::nullopt;
+                if (recovered)
+                    ctx.dispatch(recover_action{result, *recovered});
+                else
+                    ctx.dispatch(load_done_action{result});
             } catch (...) {
-                ctx.dispatch(load_error_action{{file_name, content.persistent()},
+                ctx.dispatch(load_error_action{{file_name, content},
                                                std::current_exception()});
             }
         });
     };
 }
 
-lager::effect<buffer_action> save_file_effect(immer::box<std::string> file_name,
-                      text old_content,
-                      text new_content)
+// Returns the number of bytes that `txt` takes once saved.
+std::size_t text_bytes(const text& txt)
+{
+    auto bytes = txt.size();
+    immer::for_each(txt, [&] (auto&& l) { bytes += l.size(); });
+    return bytes;
+}
+
+// Returns the offset of line `row` in the file with the contents of
+// `file`, counting from the closest end.
+std::size_t line_offset(const existing_file& file, std::size_t row)
+{
+    return row <= file.content.size() / 2
+        ? text_bytes(file.content.take(row))
+        : file.stamp.size - text_bytes(file.content.drop(row));
+}
+
+// Saves `new_content`, whose version is `new_version`, into the file
+// that had `old_file`.  When the file is left with unknown content
+// after a failure, it gets `failed_version`, which must be unused.
+lager::effect<buffer_action> save_file_effect(existing_file old_file,
+                                              text new_content,
+                                              version_t new_version,
+                                              version_t failed_version)
 {
     constexpr auto progress_report_rate_lines = std::size_t{(1 << 20) / 40};
 
     return [=] (auto& ctx) {
         ctx.loop().async([=] {
-            auto progress = saving_file{ file_name, new_content, 0 };
-            auto file = std::ofstream{};
-            file.exceptions(std::fstream::badbit | std::fstream::failbit);
+            auto span = trace_span{"save", "io"};
+            auto file_name = old_file.name;
+            auto old_content = old_file.content;
+            // when the file is still as we left it, only the lines
+            // after the ones that did not change need to be written
+            auto unchanged = matches_file_stamp(file_name, old_file.stamp)
+                ? common_prefix(old_content, new_content)
+                : std::size_t{};
+            auto in_place = unchanged > 0;
+            auto progress = saving_file{
+                file_name, new_content, unchanged, new_version };
             try {
-                file.open(file_name);
-                auto lastp = std::size_t{};
-                immer::for_each(new_content, [&] (auto l) {
-                    immer::for_each_chunk(l, [&] (auto first, auto last) {
-                        file.write(first, last - first);
-                    });
-                    file.put('\n');
-                    ++progress.saved_lines;
+                auto file  = in_place
+                    ? file_writer{file_name, line_offset(old_file, unchanged)}
+                    : file_writer{file_name};
+                auto rest  = new_content.drop(unchanged);
+                auto lastp = progress.saved_lines;
+                immer::for_each(rest, [&] (auto&& l) {
+                    file.write(l);
+                    progress.saved_lines = unchanged + file.written_lines();
                     if (progress.saved_lines - lastp > progress_report_rate_lines) {
                         ctx.dispatch(save_progress_action{progress});
                         lastp = progress.saved_lines;
                     }
                 });
-                ctx.dispatch(save_done_action{{file_name, new_content}});
+                auto stamp = file.commit();
+                ctx.dispatch(save_done_action{{
+                    file_name, new_content, stamp, new_version}});
             } catch (...) {
-                auto content = new_content.take(progress.saved_lines)
-                             + old_content.drop(progress.saved_lines);
-                ctx.dispatch(save_error_action{{file_name, content},
-                                               std::current_exception()});
+                // a new file only replaces the old one once everything
+                // has been written, so on failure the old content is
+                // still there, but a file written in place is left with
+                // a mix of both
+                auto content = !in_place ? old_content
+                    : new_content.take(progress.saved_lines)
+                    + old_content.drop(progress.saved_lines);
+                auto stamp = !in_place ? old_file.stamp : file_stamp{};
+                auto version = !in_place ? old_file.version : failed_version;
+                ctx.dispatch(save_error_action{
+                    {file_name, content, stamp, version},
+                    std::current_exception()});
             }
         });
     };
@@ -175,60 +356,155 @@ lager::effect<buffer_action> save_file_effect(immer::box<std::string> file_name,
 std::pair<buffer, lager::effect<buffer_action>> save_buffer(buffer buf)
 {
     auto file = std::get<existing_file>(buf.from);
-    buf.from = saving_file{file.name, buf.content, {}};
-    auto effect = save_file_effect(file.name, file.content, buf.content);
+    buf.from = saving_file{file.name, buf.content, {}, buf.version};
+    if (buf.dry_run) {
+        // without a stamp, as if the file could not be told apart from
+        // another one, since it was not written
+        auto done = save_done_action{{file.name, buf.content, {}, buf.version}};
+        return { buf, [done] (auto& ctx) { ctx.dispatch(done); } };
+    }
+    auto effect = save_file_effect(file, buf.content, buf.version,
+                                   ++buf.last_version);
     return { buf, effect };
 }
 
 std::pair<buffer, lager::effect<buffer_action>> load_buffer(buffer buf, const std::string& fname)
 {
-    buf.from = loading_file{fname, {}, {}, 1};
-    return { buf, load_file_effect(fname) };
+    buf.from = loading_file{fname, {}, {}, 1, buf.version};
+    buf.view = {};
+    buf.view_lines = std::nullopt;
+    return { buf, load_file_effect(fname, buf.view_threshold, !buf.dry_run) };
 }
 
 bool is_dirty(const buffer& buf)
 {
     return scelta::match(
-        [&](auto&& x) { return buf.content != x.content; })
+        [&](auto&& x) { return buf.version != x.version; })
         (buf.from);
 }
 
+bool is_read_only(const buffer& buf)
+{
+    return bool(buf.view);
+}
+
 line get_line(const text& txt, index row)
 {
     return row >= 0 && row < (index)txt.size() ? txt[row] : line{};
 }
 
-index line_length(const line& ln)
+std::size_t common_prefix(const text& a, const text& b)
+{
+    // comparing vectors stops early at the nodes that they share, so a
+    // binary search over their prefixes only visits the changed parts
+    auto lo = std::size_t{};
+    auto hi = std::min(a.size(), b.size());
+    while (lo < hi) {
+        auto mid = hi - (hi - lo) / 2;
+        if (a.take(mid) == b.take(mid))
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+std::size_t common_suffix(const text& a, const text& b, std::size_t prefix)
 {
-    return utf8::unchecked::distance(ln.begin(), ln.end());
+    auto lo = std::size_t{};
+    auto hi = std::min(a.size(), b.size()) - std::min({prefix, a.size(), b.size()});
+    while (lo < hi) {
+        auto mid = hi - (hi - lo) / 2;
+        if (a.drop(a.size() - mid) == b.drop(b.size() - mid))
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
 }
 
-std::size_t line_char(const line& ln, index col)
+line get_line(const buffer& buf, index row)
+{
+    return buf.view ? buf.view.get(row) : get_line(buf.content, row);
+}
+
+std::optional<index> line_count(const buffer& buf)
+{
+    if (buf.view)
+        return buf.view_lines;
+    return buf.content.size();
+}
+
+index line_count(const buffer& buf, index upto)
+{
+    return buf.view ? buf.view.size(upto) : buf.content.size();
+}
+
+namespace {
+
+// Returns an iterator to the code point at `col` in `ln`, or its end
+// if it is shorter.  Long lines are indexed so this does not need to
+// walk from the start of the line.
+line::iterator seek_char(const line& ln, index col)
 {
     auto fst = ln.begin();
     auto lst = ln.end();
+    if (col > 0 && ln.size() >= line_index_min_size) {
+        auto idx = get_line_index(ln);
+        if (col >= idx->length)
+            return lst;
+        else if (idx->ascii)
+            return fst + col;
+        auto point = find_char(*idx, col);
+        fst += point.offset;
+        col -= point.chars;
+    }
     while (col --> 0 && fst != lst)
         utf8::unchecked::next(fst);
-    return fst.index();
+    return fst;
+}
+
+} // anonymous namespace
+
+index line_length(const line& ln)
+{
+    return ln.size() >= line_index_min_size
+        ? get_line_index(ln)->length
+        : utf8::unchecked::distance(ln.begin(), ln.end());
+}
+
+std::size_t line_char(const line& ln, index col)
+{
+    return seek_char(ln, col).index();
 }
 
 std::pair<std::size_t, std::size_t> line_char_region(const line& ln, index col)
 {
-    auto fst = ln.begin();
-    auto lst = ln.end();
-    while (col --> 0 && fst != lst)
-        utf8::unchecked::next(fst);
+    auto fst = seek_char(ln, col);
     auto prv = fst;
-    if (fst != lst)
+    if (fst != ln.end())
         utf8::unchecked::next(fst);
     return { prv.index(), fst.index() };
 }
 
 index expand_tabs(const line& ln, index col)
 {
-    using namespace std;
+    auto first   = ln.begin();
     auto cur_col = index{};
-    for (auto c : line_range(ln)) {
+    if (col > 0 && ln.size() >= line_index_min_size) {
+        auto idx = get_line_index(ln);
+        col = std::min(col, idx->length);
+        if (!idx->tabs)
+            return col;
+        auto point = find_char(*idx, col);
+        first  += point.offset;
+        cur_col = point.column;
+        col    -= point.chars;
+    }
+    auto range = boost::make_iterator_range(
+        utf8::unchecked::iterator(first),
+        utf8::unchecked::iterator(ln.end()));
+    for (auto c : range) {
         if (col-- <= 0) break;
         if (c == '\t') {
             cur_col += tab_width - (cur_col % tab_width);
@@ -256,12 +532,13 @@ buffer page_up(buffer buf, coord size)
 
 buffer page_down(buffer buf, coord size)
 {
-    if (buf.scroll.row + size.row < (index)buf.content.size()) {
+    auto lines = line_count(buf, buf.scroll.row + size.row + 1);
+    if (buf.scroll.row + size.row < lines) {
         buf.scroll.row += size.row;
         if (buf.cursor.row < buf.scroll.row)
             buf.cursor.row = buf.scroll.row + 1;
     } else {
-        buf.cursor.row = buf.content.size();
+        buf.cursor.row = lines;
     }
     return buf;
 }
@@ -274,7 +551,8 @@ buffer move_cursor_up(buffer buf)
 
 buffer move_cursor_down(buffer buf)
 {
-    buf.cursor.row = std::min(buf.cursor.row + 1, (index)buf.content.size());
+    buf.cursor.row = std::min(buf.cursor.row + 1,
+                              line_count(buf, buf.cursor.row + 1));
     return buf;
 }
 
@@ -286,8 +564,8 @@ buffer move_line_start(buffer buf)
 
 buffer move_line_end(buffer buf)
 {
-    if (buf.cursor.row < (index)buf.content.size())
-        buf.cursor.col = line_length(buf.content[buf.cursor.row]);
+    if (buf.cursor.row < line_count(buf, buf.cursor.row + 1))
+        buf.cursor.col = line_length(get_line(buf, buf.cursor.row));
     return buf;
 }
 
@@ -299,19 +577,20 @@ buffer move_buffer_start(buffer buf)
 
 buffer move_buffer_end(buffer buf)
 {
-    buf.cursor = {(index)buf.content.size(),0};
+    if (auto lines = line_count(buf))
+        buf.cursor = {*lines, 0};
     return buf;
 }
 
 buffer move_cursor_left(buffer buf)
 {
     auto cur = buf.cursor;
-    auto ln  = get_line(buf.content, cur.row);
+    auto ln  = get_line(buf, cur.row);
     auto chr = line_char(ln, cur.col);
     if (chr == 0) {
         if (cur.row > 0) {
             buf.cursor.row -= 1;
-            buf.cursor.col = line_length(get_line(buf.content, buf.cursor.row));
+            buf.cursor.col = line_length(get_line(buf, buf.cursor.row));
         }
     } else  {
         --buf.cursor.col;
@@ -325,7 +604,7 @@ buffer move_cursor_left(buffer buf)
 buffer move_cursor_right(buffer buf)
 {
     auto cur     = buf.cursor;
-    auto ln      = get_line(buf.content, cur.row);
+    auto ln      = get_line(buf, cur.row);
     auto chr     = line_char(ln, cur.col);
     auto new_chr = line_char(ln, cur.col + 1);
     if (chr == new_chr) {
@@ -340,7 +619,7 @@ buffer move_cursor_right(buffer buf)
 buffer scroll_to_cursor(buffer buf, coord wsize)
 {
     auto cur = buf.cursor;
-    cur.col = expand_tabs(get_line(buf.content, cur.row), cur.col);
+    cur.col = expand_tabs(get_line(buf, cur.row), cur.col);
     if (cur.row >= wsize.row + buf.scroll.row) {
         buf.scroll.row = cur.row - wsize.row + 1;
     } else if (cur.row < buf.scroll.row) {
@@ -465,19 +744,36 @@ buffer insert_text(buffer buf, text paste)
     return buf;
 }
 
+namespace {
+
+// Returns the lines from `first` up to `last`, which may go past the
+// end, where there are only empty lines, like the imaginary line that
+// can be selected after the last one.
+text get_lines(const buffer& buf, index first, index last)
+{
+    auto lines = text{};
+    if (buf.view) {
+        auto t = lines.transient();
+        for (auto row = first; row < last; ++row)
+            t.push_back(buf.view.get(row));
+        lines = t.persistent();
+    } else {
+        lines = buf.content.take(last).drop(first);
+        while ((index)lines.size() < last - first)
+            lines = std::move(lines).push_back({});
+    }
+    return lines;
+}
+
+} // anonymous namespace
+
 text selected_text(buffer buf)
 {
     auto [starts, ends] = selected_region(buf);
     if (starts == ends)
         return {};
     else
-        return // actually add the imaginary line if the selection
-               // ends there
-            (ends.row == (index)buf.content.size()
-                ? buf.content.push_back({})
-                : buf.content)
-            .take(ends.row + 1)
-            .drop(starts.row)
+        return get_lines(buf, starts.row, ends.row + 1)
             .update(ends.row-starts.row, [&, ends = ends] (auto l) {
                 return l.take(line_char(l, ends.col));
             })
@@ -533,8 +829,10 @@ buffer start_selection(buffer buf)
 
 buffer select_whole_buffer(buffer buf)
 {
-    buf.cursor = {0, 0};
-    buf.selection_start = {(index)buf.content.size(), (index)buf.content.back().size()};
+    if (auto lines = line_count(buf)) {
+        buf.cursor = {0, 0};
+        buf.selection_start = {*lines, 0};
+    }
     return buf;
 }
 
@@ -550,36 +848,262 @@ std::tuple<coord, coord> selected_region(buffer buf)
         auto cursor = buf.cursor;
         auto starts = std::min(cursor, *buf.selection_start);
         auto ends   = std::max(cursor, *buf.selection_start);
-        starts.col = starts.row < (index)buf.content.size() ? starts.col : 0;
-        ends.col   = ends.row < (index)buf.content.size() ? ends.col : 0;
+        starts.col = starts.row < line_count(buf, starts.row + 1) ? starts.col : 0;
+        ends.col   = ends.row < line_count(buf, ends.row + 1) ? ends.col : 0;
         return {starts, ends};
     } else {
         return {};
     }
 }
 
+namespace {
+
+// Rough size of the nodes of the immer vectors, that have 32 branches
+constexpr auto node_branches = std::size_t{32};
+constexpr auto node_bytes    = node_branches * sizeof(void*);
+
+// Estimates the memory used by `old` that is not shared with `cur`.
+// That is the lines in between their common prefix and suffix, the
+// leaves that hold them and the path from those to the root.
+std::size_t unshared_bytes(const text& old, const text& cur)
+{
+    auto prefix  = common_prefix(old, cur);
+    auto suffix  = common_suffix(old, cur, prefix);
+    auto changed = old.take(old.size() - suffix).drop(prefix);
+    auto depth   = std::size_t{1};
+    for (auto n = old.size(); n > node_branches; n /= node_branches)
+        ++depth;
+    auto bytes = changed.size() * sizeof(line)
+        + (changed.size() / node_branches + depth) * node_bytes;
+    immer::for_each(changed, [&] (auto&& l) { bytes += l.size(); });
+    return bytes;
+}
+
+bool in_history(const buffer& buf, node_id id)
+{
+    return id >= buf.history_first
+        && id - buf.history_first < buf.history.size();
+}
+
+const undo_node& history_node(const buffer& buf, node_id id)
+{
+    return buf.history[id - buf.history_first];
+}
+
+template <typename Fn>
+buffer update_node(buffer buf, node_id id, Fn&& fn)
+{
+    buf.history = buf.history.update(id - buf.history_first,
+                                     std::forward<Fn>(fn));
+    return buf;
+}
+
+// Whether the buffer is in the state of the current node of the
+// history, as opposed to having changed since without recording it.
+bool at_history_node(const buffer& buf)
+{
+    return in_history(buf, buf.history_pos)
+        && history_node(buf, buf.history_pos).state.version == buf.version;
+}
+
+buffer restore_node(buffer buf, node_id id, coord cursor)
+{
+    const auto& node = history_node(buf, id);
+    buf.content     = node.state.content;
+    buf.cursor      = cursor;
+    buf.version     = node.state.version;
+    buf.history_pos = id;
+    return buf;
+}
+
+// Estimates the memory kept alive by node `id` with `content` as a
+// child of node `parent`.
+std::size_t node_retained(const buffer& buf, const text& content,
+                          node_id id, node_id parent)
+{
+    return sizeof(undo_node) + (
+        parent != id && in_history(buf, parent)
+        ? unshared_bytes(content, history_node(buf, parent).state.content)
+        : 0);
+}
+
+// Adds the `state` to the history as a child of the current node, and
+// makes it the new current node.
+buffer add_node(buffer buf, snapshot state, coord undo_cursor,
+                std::int64_t time_ms)
+{
+    auto id       = buf.history_first + buf.history.size();
+    auto parent   = in_history(buf, buf.history_pos) ? buf.history_pos : id;
+    auto retained = node_retained(buf, state.content, id, parent);
+    if (parent != id) {
+        buf = update_node(buf, parent, [&] (auto node) {
+            node.children = node.children.push_back(id);
+            node.next = id;
+            return node;
+        });
+    }
+    buf.history = buf.history.push_back({
+        std::move(state), undo_cursor, parent, id, {}, time_ms, retained});
+    buf.history_bytes += retained;
+    buf.history_pos = id;
+    return buf;
+}
+
+// Drops the oldest nodes until the history fits in its budget.  The
+// current node is always kept, as well as the newer ones.
+buffer trim_history(buffer buf)
+{
+    auto count = std::size_t{};
+    while (buf.history_first + count < buf.history_pos &&
+           buf.history_bytes > buf.history_budget)
+        buf.history_bytes -= buf.history[count++].retained;
+    if (count > 0) {
+        buf.history = buf.history.drop(count);
+        buf.history_first += count;
+    }
+    return buf;
+}
+
+// Whether the edit from `before` to `after` can be merged into the
+// current node.  That requires it to be of the same kind as the edits
+// that made the node, recent, on the same line and the continuation of
+// them, with nothing else changing the buffer or even moving the
+// cursor in between.
+bool continues_edit_group(const buffer& before, const buffer& after,
+                          edit_kind kind, std::int64_t time_ms)
+{
+    const auto& group = before.last_edit;
+    return kind != edit_kind::other
+        && group.kind == kind
+        && group.count < edit_group_max_size
+        && time_ms - group.time_ms <= edit_group_timeout_ms
+        && group.version == before.version
+        && group.cursor.row == before.cursor.row
+        && group.cursor.col == before.cursor.col
+        && after.cursor.row == before.cursor.row
+        && at_history_node(before)
+        && history_node(before, before.history_pos).children.empty();
+}
+
+} // anonymous namespace
+
+buffer set_history_budget(buffer buf, std::size_t bytes)
+{
+    buf.history_budget = bytes;
+    return trim_history(buf);
+}
+
 buffer undo(buffer buf)
 {
-    auto idx = buf.history_pos.value_or(buf.history.size());
-    if (idx > 0) {
-        auto restore = buf.history[--idx];
-        buf.content = restore.content;
-        buf.cursor = restore.cursor;
-        buf.history_pos = idx;
+    auto id = buf.history_pos;
+    if (!in_history(buf, id)) {
+        return buf;
+    } else if (!at_history_node(buf)) {
+        // the buffer changed without being recorded, like when loading
+        // a file, go back to the last recorded state
+        return restore_node(buf, id, history_node(buf, id).state.cursor);
+    } else {
+        const auto& node = history_node(buf, id);
+        if (node.parent == id || !in_history(buf, node.parent))
+            return buf;
+        auto cursor = node.undo_cursor;
+        buf = update_node(buf, node.parent, [&] (auto parent) {
+            parent.next = id;
+            return parent;
+        });
+        return restore_node(buf, history_node(buf, id).parent, cursor);
+    }
+}
+
+buffer redo(buffer buf)
+{
+    if (at_history_node(buf)) {
+        auto next = history_node(buf, buf.history_pos).next;
+        if (next != buf.history_pos && in_history(buf, next))
+            return restore_node(buf, next, history_node(buf, next).state.cursor);
     }
     return buf;
 }
 
-std::pair<buffer, std::string> record(buffer before, buffer after)
+buffer undo_branch(buffer buf)
+{
+    if (at_history_node(buf)) {
+        const auto& node = history_node(buf, buf.history_pos);
+        auto children = node.children;
+        auto it = std::find(children.begin(), children.end(), node.next);
+        if (children.size() > 1 && it != children.end()) {
+            auto next = ++it == children.end() ? children.front() : *it;
+            buf = update_node(buf, buf.history_pos, [&] (auto node) {
+                node.next = next;
+                return node;
+            });
+        }
+    }
+    return buf;
+}
+
+buffer undo_to_time(buffer buf, std::int64_t time_ms)
+{
+    if (buf.history.empty())
+        return buf;
+    // nodes are created in order, and only the newest one is updated
+    // when grouping edits, so they are sorted by time
+    auto lo = std::size_t{};
+    auto hi = buf.history.size() - 1;
+    while (lo < hi) {
+        auto mid = hi - (hi - lo) / 2;
+        if (buf.history[mid].time_ms <= time_ms)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    auto id = buf.history_first + lo;
+    return restore_node(buf, id, history_node(buf, id).state.cursor);
+}
+
+std::pair<buffer, std::string> record(buffer before, buffer after,
+                                      edit_kind kind, std::int64_t time_ms)
 {
     if (before.content != after.content) {
         if (load_in_progress(before)) {
             return {before, "can't edit while loading"};
+        } else if (is_read_only(before)) {
+            return {before, "can't edit a read-only view"};
+        } else if (after.history_pos != before.history_pos ||
+                   after.version != before.version) {
+            // moved to another state in the history
+            after.last_edit = {};
+        } else if (continues_edit_group(before, after, kind, time_ms)) {
+            auto id       = after.history_pos;
+            auto node     = history_node(after, id);
+            auto retained = node_retained(after, after.content, id, node.parent);
+            after.version = ++after.last_version;
+            after.history_bytes = after.history_bytes - node.retained + retained;
+            node.state    = {after.content, after.cursor, after.version};
+            node.time_ms  = time_ms;
+            node.retained = retained;
+            after.history = after.history.set(id - after.history_first, node);
+            after.last_edit = {kind, after.cursor, after.version, time_ms,
+                               before.last_edit.count + 1};
+            after = trim_history(after);
         } else {
-            after.history = after.history.push_back({before.content, before.cursor});
-            if (before.history_pos == after.history_pos)
-                after.history_pos = std::nullopt;
+            // the state that was edited is needed to undo the edit, and
+            // it is missing when the buffer changed without recording
+            if (!at_history_node(before)) {
+                after = add_node(after,
+                                 {before.content, before.cursor, before.version},
+                                 before.cursor, time_ms);
+            }
+            after.version = ++after.last_version;
+            after = add_node(after,
+                             {after.content, after.cursor, after.version},
+                             before.cursor, time_ms);
+            after.last_edit = kind == edit_kind::other ? edit_group{}
+                : edit_group{kind, after.cursor, after.version, time_ms, 1};
+            after = trim_history(after);
         }
+    } else {
+        after.last_edit = {};
     }
     return {after, ""};
 }
@@ -21,6 +21,9 @@
 #pragma once
 
 #include <ewig/coord.hpp>
+#include <ewig/file_stamp.hpp>
+#include <ewig/text.hpp>
+#include <ewig/text_view.hpp>
 
 #include <lager/store.hpp>
 #include <lager/extra/struct.hpp>
@@ -34,24 +37,38 @@
 #include <utf8.h>
 #include <boost/range/iterator_range.hpp>
 
+#include <cstdint>
+#include <limits>
 #include <optional>
 #include <variant>
 
 namespace ewig {
 
-using line = immer::flex_vector<char>;
-using text = immer::flex_vector<line>;
+/**
+ * Every state of the content of a buffer is identified by a version
+ * number.  Files remember the version of the buffer that they hold, so
+ * that checking for unsaved changes is just comparing two numbers.
+ */
+using version_t = std::size_t;
 
 struct no_file
 {
     immer::box<std::string> name = "*unnamed*";
     text content = {};
+    version_t version = 0;
 };
 
 struct existing_file
 {
     immer::box<std::string> name;
     text content;
+    /**
+     * State of the file on disk when its contents were exactly
+     * `content`, or unknown when they were not, like when the loaded
+     * file had invalid utf-8 or no newline at the end.
+     */
+    file_stamp stamp = {};
+    version_t version = 0;
 };
 
 struct saving_file
@@ -59,6 +76,7 @@ struct saving_file
     immer::box<std::string> name;
     text content;
     std::size_t saved_lines;
+    version_t version = 0;
 };
 
 struct loading_file
@@ -67,6 +85,7 @@ struct loading_file
     text content;
     std::streamoff loaded_bytes;
     std::streamoff total_bytes;
+    version_t version = 0;
 };
 
 using file = std::variant<no_file,
@@ -78,8 +97,81 @@ struct snapshot
 {
     text content;
     coord cursor;
+    version_t version;
+};
+
+/**
+ * Nodes of the undo tree are identified by the order in which they were
+ * created.  The oldest ones may be dropped from the tree, and then
+ * references to them are just ignored.
+ */
+using node_id = std::size_t;
+
+/**
+ * A state of the buffer in the undo tree.  Every edit adds a node with
+ * the resulting state as a child of the node of the state it was made
+ * on.  Undoing moves to the parent and redoing to the active child,
+ * `next`, which is the last one visited or added.  Both refer to the
+ * node itself when there is none.
+ */
+struct undo_node
+{
+    snapshot state;
+    /** Where to put the cursor when undoing the edit that led here */
+    coord undo_cursor;
+    node_id parent;
+    node_id next;
+    immer::vector<node_id> children;
+    /** Time when the node was last changed, in ms of a steady clock */
+    std::int64_t time_ms;
+    /**
+     * Estimated bytes that are kept alive only by this node, that is,
+     * not shared with the state of its parent.
+     */
+    std::size_t retained;
 };
 
+/**
+ * Kinds of edits that are undone together when they come in a quick
+ * succession on the same line, like typing or erasing characters.
+ */
+enum class edit_kind
+{
+    other,
+    insert,
+    erase,
+};
+
+/**
+ * The edits that are merged into the current node of the history.
+ */
+struct edit_group
+{
+    edit_kind kind = edit_kind::other;
+    /** Cursor and version right after the last edit in the group */
+    coord cursor = {};
+    version_t version = 0;
+    /** Time of the last edit, in milliseconds of a steady clock */
+    std::int64_t time_ms = 0;
+    std::size_t count = 0;
+};
+
+/**
+ * Maximum time between edits and number of them in an `edit_group`.
+ */
+constexpr auto edit_group_timeout_ms = std::int64_t{1000};
+constexpr auto edit_group_max_size   = std::size_t{20};
+
+/**
+ * Default memory budget for the undo history of a buffer.
+ */
+constexpr auto default_history_budget = std::size_t{256} << 20;
+
+/**
+ * Value of `buffer::view_threshold` that never opens files as views.
+ */
+constexpr auto no_view_threshold = std::numeric_limits<std::size_t>::max();
+
 struct buffer
 {
     file from;
@@ -87,20 +179,46 @@ struct buffer
     coord cursor;
     coord scroll;
     std::optional<coord> selection_start;
-    immer::vector<snapshot> history;
-    std::optional<std::size_t> history_pos;
+    immer::flex_vector<undo_node> history;
+    node_id history_first = 0;
+    node_id history_pos = 0;
+    std::size_t history_bytes = 0;
+    std::size_t history_budget = default_history_budget;
+    edit_group last_edit;
+    text_view view;
+    /** Number of lines of `view`, once counted in the background */
+    std::optional<index> view_lines;
+    /**
+     * Files of at least this size are opened as a read-only `text_view`
+     * instead of being loaded in memory.
+     */
+    std::size_t view_threshold = no_view_threshold;
+    /**
+     * Leaves the file system alone, as when replaying a session: files
+     * are loaded without recovering their journal and saves complete
+     * without writing anything.
+     */
+    bool dry_run = false;
+    version_t version = 0;
+    version_t last_version = 0;
 };
 
 struct load_progress_action { loading_file file; };
 struct load_done_action { existing_file file; };
+struct view_done_action { existing_file file; text_view view; };
+struct view_count_action { text_view view; index lines; };
 struct load_error_action { existing_file file; std::exception_ptr err; };
+struct recover_action { existing_file file; text content; };
 struct save_progress_action { saving_file file; };
 struct save_done_action { existing_file file; };
 struct save_error_action { existing_file file; std::exception_ptr err; };
 
 using buffer_action = std::variant<load_progress_action,
                                    load_done_action,
+                                   view_done_action,
+                                   view_count_action,
                                    load_error_action,
+                                   recover_action,
                                    save_progress_action,
                                    save_done_action,
                                    save_error_action>;
@@ -131,9 +249,39 @@ inline auto line_range(const line& ln)
 
 line get_line(const text& txt, index row);
 
+/**
+ * Returns the number of lines at the beginning of `a` and `b` that are
+ * equal.  This is fast when they share most of their structure, as it
+ * happens when one is an edited version of the other.
+ */
+std::size_t common_prefix(const text& a, const text& b);
+
+/**
+ * Returns the number of lines at the end of `a` and `b` that are equal,
+ * not counting the first `prefix` lines, so that it can be combined
+ * with the result of `common_prefix()`.
+ */
+std::size_t common_suffix(const text& a, const text& b, std::size_t prefix = 0);
+
+/**
+ * Returns the line at `row` in the buffer, which may come from its
+ * content or from the file it is viewing.
+ */
+line get_line(const buffer& buf, index row);
+
+/**
+ * Returns the number of lines in the buffer, or nothing when viewing a
+ * file whose lines are still being counted.  Navigation should rather
+ * use the second overload, that only makes sure to count up to `upto`
+ * lines, which is always known.
+ */
+std::optional<index> line_count(const buffer& buf);
+index line_count(const buffer& buf, index upto);
+
 bool io_in_progress(const buffer&);
 bool load_in_progress(const buffer&);
 bool is_dirty(const buffer& buf);
+bool is_read_only(const buffer& buf);
 
 std::pair<buffer, std::string> update_buffer(buffer buf, buffer_action ac);
 
@@ -148,6 +296,7 @@ buffer page_down(buffer buf, coord size);
 buffer move_line_start(buffer buf);
 buffer move_line_end(buffer buf);
 buffer move_buffer_start(buffer buf);
+/** Does nothing while the lines of a view are being counted */
 buffer move_buffer_end(buffer buf);
 
 buffer move_cursor_up(buffer buf);
@@ -169,25 +318,61 @@ std::pair<buffer, text> copy(buffer buf);
 std::pair<buffer, text> cut(buffer buf);
 std::pair<buffer, text> cut_rest(buffer buf);
 
+/** Does nothing while the lines of a view are being counted */
 buffer select_whole_buffer(buffer buf);
 buffer start_selection(buffer buf);
 buffer clear_selection(buffer buf);
 std::tuple<coord, coord> selected_region(buffer buf);
+text selected_text(buffer buf);
 
 buffer undo(buffer);
-std::pair<buffer, std::string> record(buffer before, buffer after);
+buffer redo(buffer);
+
+/**
+ * Changes the branch that `redo()` follows from the current state to
+ * the next one made from it.
+ */
+buffer undo_branch(buffer);
+
+/**
+ * Goes to the newest state in the history that is not newer than
+ * `time_ms`, in the same clock that is passed to `record()`.
+ */
+buffer undo_to_time(buffer buf, std::int64_t time_ms);
+
+/**
+ * Records the change from `before` to `after` in the history, unless it
+ * was just moving to another state of it.  Edits of the same `kind`,
+ * other than `edit_kind::other`, are merged into the same node when
+ * they follow each other on the same line within a short time,
+ * `time_ms` being when this one happened.
+ */
+std::pair<buffer, std::string> record(buffer before, buffer after,
+                                      edit_kind kind = edit_kind::other,
+                                      std::int64_t time_ms = 0);
+
+/**
+ * Changes the memory budget of the history, dropping its oldest nodes
+ * when they do not fit anymore.
+ */
+buffer set_history_budget(buffer buf, std::size_t bytes);
 
 } // namespace ewig
 
-LAGER_STRUCT(ewig, no_file, name, content);
-LAGER_STRUCT(ewig, existing_file, name, content);
-LAGER_STRUCT(ewig, saving_file, name, content, saved_lines);
-LAGER_STRUCT(ewig, loading_file, name, content, loaded_bytes, total_bytes);
-LAGER_STRUCT(ewig, snapshot, content, cursor);
-LAGER_STRUCT(ewig, buffer, from, content, cursor, scroll, selection_start, history, history_pos);
+LAGER_STRUCT(ewig, no_file, name, content, version);
+LAGER_STRUCT(ewig, existing_file, name, content, stamp, version);
+LAGER_STRUCT(ewig, saving_file, name, content, saved_lines, version);
+LAGER_STRUCT(ewig, loading_file, name, content, loaded_bytes, total_bytes, version);
+LAGER_STRUCT(ewig, snapshot, content, cursor, version);
+LAGER_STRUCT(ewig, undo_node, state, undo_cursor, parent, next, children, time_ms, retained);
+LAGER_STRUCT(ewig, edit_group, kind, cursor, version, time_ms, count);
+LAGER_STRUCT(ewig, buffer, from, content, cursor, scroll, selection_start, history, history_first, history_pos, history_bytes, history_budget, last_edit, view, view_lines, view_threshold, dry_run, version, last_version);
 LAGER_STRUCT(ewig, load_progress_action, file);
 LAGER_STRUCT(ewig, load_done_action, file);
+LAGER_STRUCT(ewig, view_done_action, file, view);
+LAGER_STRUCT(ewig, view_count_action, view, lines);
 LAGER_STRUCT(ewig, load_error_action, file, err);
+LAGER_STRUCT(ewig, recover_action, file, content);
 LAGER_STRUCT(ewig, save_progress_action, file);
 LAGER_STRUCT(ewig, save_done_action, file);
 LAGER_STRUCT(ewig, save_error_action, file, err);
@@ -19,17 +19,18 @@
 //
 
 #include "ewig/draw.hpp"
+#include "ewig/line_index.hpp"
+#include "ewig/trace.hpp"
 
 #include <scelta.hpp>
+#include <utf8.h>
 
-extern "C" {
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
 
-#ifndef _XOPEN_SOURCE_EXTENDED
-    #define _XOPEN_SOURCE_EXTENDED
-#endif
-
-#include <ncurses.h>
-}
+using namespace std::string_literals;
 
 namespace ewig{
 
@@ -38,13 +39,24 @@ namespace {
 // Fills the string `str` with the display contents of the line `ln`
 // between the display columns `first_col` and `first_col + num_col`.
 // It takes into account tabs, expanding them correctly, and fills the
-// remaining until num_col with spaces.
+// remaining until num_col with spaces.  Long lines start from the
+// closest indexed position before `first_col`, so that the cost does not
+// grow as we scroll right.
 void display_line_fill(const line& ln, int first_col, int num_col,
                        std::wstring& str)
 {
     using namespace std;
+    auto first   = ln.begin();
     auto cur_col = index{};
-    for (auto c : line_range(ln)) {
+    if (first_col > 0 && ln.size() >= line_index_min_size) {
+        auto point = find_column(*get_line_index(ln), first_col);
+        first  += point.offset;
+        cur_col = point.column;
+    }
+    auto range = boost::make_iterator_range(
+        utf8::unchecked::iterator(first),
+        utf8::unchecked::iterator(ln.end()));
+    for (auto c : range) {
         if (num_col == cur_col - first_col)
             return;
         else if (c == '\t') {
@@ -65,8 +77,8 @@ void display_line_fill(const line& ln, int first_col, int num_col,
 std::pair<coord, coord> display_selected_region(const buffer& buf)
 {
     auto [starts, ends] = selected_region(buf);
-    starts.col  = expand_tabs(get_line(buf.content, starts.row), starts.col);
-    ends.col    = expand_tabs(get_line(buf.content, ends.row), ends.col);
+    starts.col  = expand_tabs(get_line(buf, starts.row), starts.col);
+    ends.col    = expand_tabs(get_line(buf, ends.row), ends.col);
     starts.row -= buf.scroll.row;
     ends.row   -= buf.scroll.row;
     starts.col -= buf.scroll.col;
@@ -74,116 +86,197 @@ std::pair<coord, coord> display_selected_region(const buffer& buf)
     return {starts, ends};
 }
 
-} // anonymous namespace
+// What was last drawn on a row of the text area.  A negative
+// `first_col` marks a row that has to be drawn again.
+struct drawn_row
+{
+    line ln;
+    index first_col = -1;
+    index hl_first  = 0;
+    index hl_last   = 0;
+};
 
-void draw_text(const buffer& buf, coord size)
+// What is currently on the screen, so that only what changes needs to
+// be drawn again.  Lines are compared with `==`, which for the lines
+// that are shared with the previous state only compares a pointer.
+struct drawn_screen
 {
-    using namespace std;
-    int col, row;
-    attrset(A_NORMAL);
-    getyx(stdscr, col, row);
-
-    auto str      = std::wstring{};
-    auto first_ln = begin(buf.content) + min(buf.scroll.row,
-                                             (index)buf.content.size());
-    auto last_ln  = begin(buf.content) + min(size.row + buf.scroll.row,
-                                             (index)buf.content.size());
-    auto [starts, ends] = display_selected_region(buf);
+    std::uint64_t screen_id = 0;
+    coord size = {-1, -1};
+    std::vector<drawn_row> rows;
+    std::string mode_line;
+    std::string message;
+};
 
-    immer::for_each(first_ln, last_ln, [&, starts=starts, ends=ends] (auto ln) {
-        str.clear();
-        display_line_fill(ln, buf.scroll.col + col, 2*size.col, str);
-        ::move(row, col);
-        auto in_selection = row >= starts.row && row <= ends.row;
-        if (in_selection) {
-            auto hl_first = row == starts.row ? std::max(starts.col, 0) : 0;
-            auto hl_last  = row == ends.row   ? std::max(ends.col, 0) : str.size();
-            ::addnwstr(str.c_str(), hl_first);
-            ::attron(COLOR_PAIR((int)color::selection));
-            ::addnwstr(str.c_str() + hl_first, hl_last - hl_first);
-            ::attroff(COLOR_PAIR((int)color::selection));
-            ::addnwstr(str.c_str() + hl_last, str.size() - hl_last);
-        } else {
-            ::addwstr(str.c_str());
-        }
-        row++;
-    });
+drawn_screen& drawn()
+{
+    static auto s = drawn_screen{};
+    return s;
 }
 
-void draw_mode_line(const buffer& buf, index maxcol)
+// Forgets what is on the screen, and clears it, when drawing on another
+// screen or when the size of the window changes.
+void check_screen(screen& scr, coord window_size, coord size)
 {
-    attrset(A_REVERSE);
-    auto dirty_mark = is_dirty(buf) ? "**" : "--";
+    auto& s = drawn();
+    if (s.screen_id != scr.id() ||
+        s.size.row != window_size.row ||
+        s.size.col != window_size.col) {
+        s = drawn_screen{};
+        s.screen_id = scr.id();
+        s.size = window_size;
+        s.rows.resize(std::max(size.row, 0));
+        scr.resize(window_size);
+    }
+}
+
+std::wstring to_wide(const std::string& str)
+{
+    auto valid = std::string{};
+    utf8::replace_invalid(str.begin(), str.end(), std::back_inserter(valid));
+    return {utf8::unchecked::iterator(valid.begin()),
+            utf8::unchecked::iterator(valid.end())};
+}
+
+std::string mode_line_text(const buffer& buf)
+{
+    auto dirty_mark = is_read_only(buf) ? "%%" : is_dirty(buf) ? "**" : "--";
     auto file_name = scelta::match([](auto&& f) { return f.name; })(buf.from);
     auto cur = buf.cursor;
-    cur.col = expand_tabs(get_line(buf.content, cur.row), cur.col);
-    ::printw(" %s %s  (%d, %d)",
-            dirty_mark,
-            file_name.get().c_str(),
-            cur.col, cur.row);
-    ::hline(' ', maxcol);
-
-    scelta::match(
+    cur.col = expand_tabs(get_line(buf, cur.row), cur.col);
+    // views show how many lines there are, which is unknown until
+    // they are counted
+    auto lines = !buf.view ? ""s
+        : "/"s + (buf.view_lines ? std::to_string(*buf.view_lines) : "?"s);
+    return " "s + dirty_mark + " " + file_name.get() + "  ("
+        + std::to_string(cur.col) + ", " + std::to_string(cur.row) + lines + ")";
+}
+
+std::string mode_line_progress(const buffer& buf)
+{
+    auto show = [] (const char* what, float progress) {
+        auto percentage = std::to_string(int(progress * 100));
+        return " "s + what + " "
+            + std::string(std::max(0, 2 - int(percentage.size())), ' ')
+            + percentage + "% ";
+    };
+    return scelta::match(
         [&] (const saving_file& file) {
-            auto str        = std::string{"saving..."};
-            auto size       = std::max(file.content.size(), std::size_t{1});
-            auto progress   = (float)file.saved_lines / size;
-            auto percentage = int(progress * 100);
-            ::move(getcury(stdscr), maxcol - str.size() - 6);
-            attrset(A_NORMAL | A_BOLD);
-            ::attron(COLOR_PAIR((int)color::mode_line_message));
-            ::printw(" %s %*d%% ", str.c_str(), 2, percentage);
+            auto size = std::max(file.content.size(), std::size_t{1});
+            return show("saving...", (float)file.saved_lines / size);
         },
         [&] (const loading_file& file) {
-            auto str        = std::string{"loading..."};
-            auto progress   = (float)file.loaded_bytes / file.total_bytes;
-            auto percentage = int(progress * 100);
-            ::move(getcury(stdscr), maxcol - str.size() - 6);
-            attrset(A_NORMAL | A_BOLD);
-            ::attron(COLOR_PAIR((int)color::mode_line_message));
-            ::printw(" %s %*d%% ", str.c_str(), 2, percentage);
+            return show("loading...",
+                        (float)file.loaded_bytes / file.total_bytes);
         },
-        [](auto&&) {})(buf.from);
+        [](auto&&) { return std::string{}; })(buf.from);
 }
 
-void draw_message(const message& msg)
+} // anonymous namespace
+
+void draw_text(screen& scr, const buffer& buf, coord size)
 {
-    attrset(A_NORMAL);
-    ::attron(COLOR_PAIR((int)color::message));
-    ::addstr(" ");
-    ::addstr(msg.content.get().c_str());
-    ::attroff(COLOR_PAIR((int)color::message));
+    using namespace std;
+    auto& rows = drawn().rows;
+    auto row = 0;
+
+    auto str = std::wstring{};
+    auto [starts, ends] = display_selected_region(buf);
+
+    auto draw_line = [&, starts=starts, ends=ends] (auto ln) {
+        auto in_selection = row >= starts.row && row <= ends.row;
+        auto hl_first = !in_selection    ? 0
+            :           row == starts.row ? clamp(starts.col, 0, size.col)
+            :           0;
+        auto hl_last  = !in_selection    ? 0
+            :           row == ends.row   ? clamp(ends.col, 0, size.col)
+            :           size.col;
+        auto& last = rows[row];
+        if (last.first_col != buf.scroll.col ||
+            last.hl_first != hl_first ||
+            last.hl_last != hl_last ||
+            !(last.ln == ln)) {
+            str.clear();
+            display_line_fill(ln, buf.scroll.col, size.col, str);
+            auto view = std::wstring_view{str};
+            auto col  = scr.put({row, 0}, view.substr(0, hl_first), face::normal);
+            col = scr.put({row, col}, view.substr(hl_first, hl_last - hl_first),
+                          face::selection);
+            col = scr.put({row, col}, view.substr(hl_last), face::normal);
+            scr.clear_line({row, col}, face::normal);
+            last = {ln, buf.scroll.col, hl_first, hl_last};
+        }
+        row++;
+    };
+
+    if (buf.view) {
+        auto last_row = min(size.row + buf.scroll.row,
+                            line_count(buf, size.row + buf.scroll.row));
+        for (auto r = buf.scroll.row; r < last_row; ++r)
+            draw_line(get_line(buf, r));
+    } else {
+        auto first_ln = begin(buf.content) + min(buf.scroll.row,
+                                                 (index)buf.content.size());
+        auto last_ln  = begin(buf.content) + min(size.row + buf.scroll.row,
+                                                 (index)buf.content.size());
+        immer::for_each(first_ln, last_ln, draw_line);
+    }
+    while (row < size.row)
+        draw_line(line{});
 }
 
-void draw_text_cursor(const buffer& buf, coord window_size)
+void draw_mode_line(screen& scr, const buffer& buf, index row, index maxcol)
 {
-    auto cur = buf.cursor;
-    cur.col = expand_tabs(get_line(buf.content, cur.row), cur.col);
-    ::move(cur.row - buf.scroll.row, cur.col - buf.scroll.col);
-    ::curs_set(cur.col >= buf.scroll.col &&
-               cur.row >= buf.scroll.row &&
-               cur.col < buf.scroll.col + window_size.col &&
-               cur.row < buf.scroll.row + window_size.row);
+    auto text     = mode_line_text(buf);
+    auto progress = mode_line_progress(buf);
+    auto& last    = drawn().mode_line;
+    if (last == text + progress)
+        return;
+    last = text + progress;
+    auto col = scr.put({row, 0}, to_wide(text), face::mode_line);
+    scr.clear_line({row, col}, face::mode_line);
+    if (!progress.empty())
+        scr.put({row, maxcol - (index)progress.size()}, to_wide(progress),
+                face::mode_line_message);
 }
 
-void draw(const application& app)
+void draw_message(screen& scr, const message& msg, index row)
 {
-    ::erase();
-
-    auto size = editor_size(app);
-    ::move(0, 0);
-    draw_text(app.current, size);
-
-    ::move(size.row, 0);
-    draw_mode_line(app.current, size.col);
+    auto& last = drawn().message;
+    if (last == msg.content.get())
+        return;
+    last = msg.content.get();
+    auto col = scr.put({row, 0}, to_wide(" " + last), face::message);
+    scr.clear_line({row, col}, face::normal);
+}
 
-    if (!app.messages.empty()) {
-        ::move(size.row + 1, 0);
-        draw_message(app.messages.back());
-    }
+void draw_text_cursor(screen& scr, const buffer& buf, coord window_size)
+{
+    auto cur = buf.cursor;
+    cur.col = expand_tabs(get_line(buf, cur.row), cur.col);
+    auto visible = cur.col >= buf.scroll.col &&
+                   cur.row >= buf.scroll.row &&
+                   cur.col < buf.scroll.col + window_size.col &&
+                   cur.row < buf.scroll.row + window_size.row;
+    scr.show_cursor(visible
+                    ? std::optional<coord>{{cur.row - buf.scroll.row,
+                                            cur.col - buf.scroll.col}}
+                    : std::nullopt);
+}
 
-    draw_text_cursor(app.current, size);
-    ::refresh();
+void draw(screen& scr, const application& app)
+{
+    auto size = editor_size(app);
+    // the visible lines and the cursor line, so that drawing does not
+    // evict the indices of the lines that it is about to draw
+    reserve_line_index_cache(size.row + 1);
+    check_screen(scr, app.window_size, size);
+    draw_text(scr, app.current, size);
+    draw_mode_line(scr, app.current, size.row, size.col);
+    draw_message(scr, last_message(app.messages), size.row + 1);
+    draw_text_cursor(scr, app.current, size);
+    auto span = trace_span{"flush"};
+    scr.flush();
 }
 
 } // namespace ewig
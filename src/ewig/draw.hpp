@@ -21,19 +21,13 @@
 #pragma once
 
 #include <ewig/application.hpp>
+#include <ewig/screen.hpp>
 
 namespace ewig {
 
-enum class color
-{
-    message = 1,
-    selection,
-    mode_line_message,
-};
-
-void draw(const application& app);
-void draw_text(const buffer& buf, coord size);
-void draw_mode_line(const buffer& buffer, index maxcol);
-void draw_message(const message& msg);
+void draw(screen& scr, const application& app);
+void draw_text(screen& scr, const buffer& buf, coord size);
+void draw_mode_line(screen& scr, const buffer& buffer, index row, index maxcol);
+void draw_message(screen& scr, const message& msg, index row);
 
 } // namespace ewig
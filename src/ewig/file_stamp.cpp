@@ -0,0 +1,68 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "ewig/file_stamp.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+extern "C" {
+#include <sys/stat.h>
+}
+
+namespace ewig {
+
+namespace {
+
+file_stamp make_stamp(const struct stat& st)
+{
+    return {
+        std::uint64_t(st.st_ino),
+        std::uint64_t(st.st_size),
+        std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+    };
+}
+
+} // anonymous namespace
+
+file_stamp get_file_stamp(const std::string& fname)
+{
+    struct stat st;
+    return ::stat(fname.c_str(), &st) == 0 ? make_stamp(st) : file_stamp{};
+}
+
+file_stamp get_file_stamp(int fd)
+{
+    struct stat st;
+    if (::fstat(fd, &st) < 0)
+        throw std::system_error{errno, std::system_category(), "fstat"};
+    return make_stamp(st);
+}
+
+bool matches_file_stamp(const std::string& fname, const file_stamp& stamp)
+{
+    auto current = get_file_stamp(fname);
+    return stamp.inode != 0
+        && current.inode == stamp.inode
+        && current.size == stamp.size
+        && current.mtime_ns == stamp.mtime_ns;
+}
+
+} // namespace ewig
@@ -0,0 +1,62 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <lager/extra/struct.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace ewig {
+
+/**
+ * Identifies the state of a file on disk, so we can tell whether it was
+ * changed by someone else since we last read or wrote it.  A default
+ * constructed stamp is unknown and matches no file.
+ */
+struct file_stamp
+{
+    std::uint64_t inode = 0;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+};
+
+/**
+ * Returns the stamp of the file `fname`, or an unknown stamp when the
+ * file can not be accessed.
+ */
+file_stamp get_file_stamp(const std::string& fname);
+
+/**
+ * Returns the stamp of the open file descriptor `fd`, throwing
+ * `std::system_error` on failure.
+ */
+file_stamp get_file_stamp(int fd);
+
+/**
+ * Returns whether the file `fname` is still exactly in the state
+ * identified by `stamp`.
+ */
+bool matches_file_stamp(const std::string& fname, const file_stamp& stamp);
+
+} // namespace ewig
+
+LAGER_STRUCT(ewig, file_stamp, inode, size, mtime_ns);
@@ -0,0 +1,187 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/file_writer.hpp"
+
+#include <immer/algorithm.hpp>
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace ewig {
+
+namespace {
+
+// Linux and the BSDs accept this many buffers in a single writev,
+// POSIX only guarantees 16 but they all have IOV_MAX >= 1024
+constexpr auto max_pending_buffers = std::size_t{1024};
+
+const char newline = '\n';
+
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error{errno, std::system_category(), what};
+}
+
+// When `fname` is a symlink, returns the file it points to, so that
+// the latter is what gets replaced when saving.
+std::string resolve_path(const std::string& fname)
+{
+    auto path = std::unique_ptr<char, decltype(&std::free)>{
+        ::realpath(fname.c_str(), nullptr), &std::free};
+    return path ? std::string{path.get()} : fname;
+}
+
+std::string directory_of(const std::string& fname)
+{
+    auto pos = fname.rfind('/');
+    return pos == std::string::npos ? "."
+        :  pos == 0                 ? "/"
+        :  fname.substr(0, pos);
+}
+
+} // anonymous namespace
+
+file_writer::file_writer(const std::string& fname)
+    : target_{resolve_path(fname)}
+    , temp_{target_ + ".ewig-save-" + std::to_string(::getpid())}
+{
+    fd_ = ::open(temp_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd_ < 0)
+        throw_errno(temp_);
+    // keep the permissions of the file that we are replacing
+    struct stat st;
+    if (::stat(target_.c_str(), &st) == 0)
+        ::fchmod(fd_, st.st_mode & 07777);
+    pending_.reserve(max_pending_buffers);
+}
+
+file_writer::file_writer(const std::string& fname, std::size_t offset)
+    : target_{fname}
+{
+    fd_ = ::open(target_.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd_ < 0)
+        throw_errno(target_);
+    if (::lseek(fd_, offset, SEEK_SET) < 0) {
+        auto err = errno;
+        ::close(std::exchange(fd_, -1));
+        errno = err;
+        throw_errno(target_);
+    }
+    pending_.reserve(max_pending_buffers);
+}
+
+file_writer::~file_writer()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        if (!temp_.empty())
+            ::unlink(temp_.c_str());
+    }
+}
+
+const std::string& file_writer::path_() const
+{
+    return temp_.empty() ? target_ : temp_;
+}
+
+void file_writer::write(const line& ln)
+{
+    immer::for_each_chunk(ln, [&] (auto first, auto last) {
+        if (pending_.size() == max_pending_buffers)
+            flush_();
+        pending_.push_back({const_cast<char*>(first), std::size_t(last - first)});
+    });
+    if (pending_.size() == max_pending_buffers)
+        flush_();
+    pending_.push_back({const_cast<char*>(&newline), 1});
+    ++pending_lines_;
+}
+
+void file_writer::flush_()
+{
+    auto iov   = pending_.data();
+    auto count = int(pending_.size());
+    while (count > 0) {
+        auto written = ::writev(fd_, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw_errno(path_());
+        }
+        // skip what was written, which may end in the middle of a
+        // buffer when the write was partial
+        for (; count > 0 && std::size_t(written) >= iov->iov_len; --count)
+            written -= (iov++)->iov_len;
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    pending_.clear();
+    written_lines_ += pending_lines_;
+    pending_lines_ = 0;
+}
+
+file_stamp file_writer::commit()
+{
+    flush_();
+    if (temp_.empty()) {
+        // drop whatever was left of the old content past the new end
+        auto end = ::lseek(fd_, 0, SEEK_CUR);
+        if (end < 0 || ::ftruncate(fd_, end) < 0)
+            throw_errno(target_);
+    }
+    if (::fsync(fd_) < 0)
+        throw_errno(path_());
+    auto stamp = get_file_stamp(fd_);
+    auto fd = std::exchange(fd_, -1);
+    if (temp_.empty()) {
+        if (::close(fd) < 0)
+            throw_errno(target_);
+        return stamp;
+    }
+    if (::close(fd) < 0 || ::rename(temp_.c_str(), target_.c_str()) < 0) {
+        auto err = errno;
+        ::unlink(temp_.c_str());
+        errno = err;
+        throw_errno(target_);
+    }
+    // make the rename itself durable, failing to do so is not an error
+    // since the content is already safely written
+    auto dir = ::open(directory_of(target_).c_str(), O_RDONLY | O_CLOEXEC);
+    if (dir >= 0) {
+        ::fsync(dir);
+        ::close(dir);
+    }
+    return stamp;
+}
+
+} // namespace ewig
@@ -0,0 +1,95 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/file_stamp.hpp>
+#include <ewig/text.hpp>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/uio.h>
+}
+
+namespace ewig {
+
+/**
+ * Writes lines to a file, gathering their chunks and the newlines
+ * after them into big batches that are written with a single `writev`
+ * call, avoiding any intermediate copies.
+ *
+ * By default the content goes to a temporary file next to the target,
+ * which is synced and atomically renamed over it on `commit()`.  When
+ * the writer is destroyed without committing, the temporary file is
+ * removed and the target is left untouched.  Alternatively, the
+ * target can be overwritten in place from some offset on, which
+ * avoids writing again the data before it but leaves the file with a
+ * mix of old and new content when something fails.  Errors are
+ * reported throwing `std::system_error`.
+ *
+ * The chunks of the lines are only referenced until the next flush,
+ * so the lines passed to `write()` must outlive the writer or the
+ * call to `commit()`.
+ */
+struct file_writer
+{
+    /** Writes a new file that replaces `fname` on commit */
+    explicit file_writer(const std::string& fname);
+
+    /**
+     * Overwrites the existing file `fname` from byte `offset` on, and
+     * truncates it after the last written byte on commit.
+     */
+    file_writer(const std::string& fname, std::size_t offset);
+
+    ~file_writer();
+
+    file_writer(const file_writer&) = delete;
+    file_writer& operator=(const file_writer&) = delete;
+
+    /** Appends the line `ln` followed by a newline */
+    void write(const line& ln);
+
+    /**
+     * Flushes all pending data, makes it durable and, unless writing in
+     * place, replaces the target file.  Returns the stamp of the
+     * resulting file.
+     */
+    file_stamp commit();
+
+    /** Number of lines whose data has been completely written */
+    std::size_t written_lines() const { return written_lines_; }
+
+private:
+    void flush_();
+    const std::string& path_() const;
+
+    std::string target_;
+    std::string temp_;
+    int fd_ = -1;
+    std::vector<::iovec> pending_;
+    std::size_t pending_lines_ = 0;
+    std::size_t written_lines_ = 0;
+};
+
+} // namespace ewig
@@ -0,0 +1,71 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/frame_scheduler.hpp"
+
+namespace ewig {
+
+frame_scheduler::frame_scheduler(boost::asio::io_service& serv,
+                                 draw_fn draw,
+                                 int max_fps)
+    : serv_{serv}
+    , timer_{serv}
+    , draw_fn_{std::move(draw)}
+    , min_interval_{max_fps > 0
+                    ? std::chrono::duration_cast<clock::duration>(
+                        std::chrono::seconds{1}) / max_fps
+                    : clock::duration::zero()}
+{}
+
+void frame_scheduler::update(const application& app)
+{
+    if (pending_)
+        ++skipped_;
+    pending_ = app;
+    if (scheduled_)
+        return;
+    scheduled_ = true;
+    auto next_frame = last_frame_ + min_interval_;
+    if (clock::now() < next_frame) {
+        timer_.expires_at(next_frame);
+        timer_.async_wait([this] (auto ec) {
+            if (!ec) draw_();
+        });
+    } else {
+        // posting puts us behind whatever is already waiting in the
+        // queue, so everything that it dispatches ends in this frame
+        serv_.post([this] { draw_(); });
+    }
+}
+
+void frame_scheduler::draw_()
+{
+    scheduled_  = false;
+    last_frame_ = clock::now();
+    if (pending_) {
+        auto app = std::move(*pending_);
+        pending_.reset();
+        draw_fn_(app);
+        ++drawn_;
+    }
+}
+
+} // namespace ewig
@@ -0,0 +1,76 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/application.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
+
+namespace ewig {
+
+/**
+ * Draws the states of the application coalescing them into frames.
+ *
+ * `update()` only takes note of the new state, which is drawn once the
+ * handlers already queued in the event loop have run.  This way a burst
+ * of actions, like many keys arriving at once or the progress of a
+ * load, produces a single frame.  Optionally, frames can also be kept
+ * at least `1 / max_fps` seconds apart.
+ */
+class frame_scheduler
+{
+public:
+    using clock   = std::chrono::steady_clock;
+    using draw_fn = std::function<void(const application&)>;
+
+    /** A `max_fps` of zero does not limit the frame rate */
+    frame_scheduler(boost::asio::io_service& serv, draw_fn draw, int max_fps = 0);
+
+    void update(const application& app);
+
+    /** Number of frames that were drawn */
+    std::size_t frames_drawn() const { return drawn_; }
+
+    /** Number of states that were replaced by a newer one before being drawn */
+    std::size_t frames_skipped() const { return skipped_; }
+
+private:
+    void draw_();
+
+    boost::asio::io_service& serv_;
+    boost::asio::steady_timer timer_;
+    draw_fn draw_fn_;
+    clock::duration min_interval_;
+    clock::time_point last_frame_;
+    std::optional<application> pending_;
+    bool scheduled_ = false;
+    std::size_t drawn_ = 0;
+    std::size_t skipped_ = 0;
+};
+
+} // namespace ewig
@@ -0,0 +1,354 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "ewig/journal.hpp"
+#include "ewig/mapped_file.hpp"
+
+#include <immer/algorithm.hpp>
+#include <scelta.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+namespace ewig {
+
+namespace {
+
+// The journal starts with a header identifying the file that it
+// applies to, followed by records of changes.  Every record starts
+// with its size and a checksum of the rest, so the partially written
+// ones can be told apart.  A change replaces `removed` lines starting
+// at `first` with `count` new lines.  Everything is stored in the
+// native byte order, since the journal is not meant to be portable.
+//
+//     header: magic inode size mtime_ns
+//     record: size checksum first removed count (length bytes)*
+//
+const char journal_magic[] = {'E', 'W', 'I', 'G', 'J', 'R', 'N', '1'};
+
+constexpr auto record_header_bytes = 2 * sizeof(std::uint32_t);
+
+template <typename T>
+void put(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool get(const char*& first, const char* last, T& value)
+{
+    if (std::size_t(last - first) < sizeof(value))
+        return false;
+    std::memcpy(&value, first, sizeof(value));
+    first += sizeof(value);
+    return true;
+}
+
+// FNV-1a, which is enough to detect torn writes
+std::uint32_t checksum(const char* first, const char* last)
+{
+    auto hash = std::uint32_t{2166136261u};
+    for (; first != last; ++first)
+        hash = (hash ^ std::uint8_t(*first)) * 16777619u;
+    return hash;
+}
+
+bool same_stamp(const file_stamp& a, const file_stamp& b)
+{
+    return a.inode == b.inode && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+void encode_header(std::string& out, const file_stamp& stamp)
+{
+    out.append(std::begin(journal_magic), std::end(journal_magic));
+    put(out, stamp.inode);
+    put(out, stamp.size);
+    put(out, stamp.mtime_ns);
+}
+
+void encode_change(std::string& out, std::size_t first, std::size_t removed,
+                   const text& lines)
+{
+    auto start = out.size();
+    out.append(record_header_bytes, '\0');
+    put(out, std::uint64_t(first));
+    put(out, std::uint64_t(removed));
+    put(out, std::uint64_t(lines.size()));
+    immer::for_each(lines, [&] (auto&& ln) {
+        put(out, std::uint32_t(ln.size()));
+        immer::for_each_chunk(ln, [&] (auto f, auto l) { out.append(f, l); });
+    });
+    auto size = std::uint32_t(out.size() - start - record_header_bytes);
+    auto sum  = checksum(out.data() + start + record_header_bytes,
+                         out.data() + out.size());
+    std::memcpy(&out[start], &size, sizeof(size));
+    std::memcpy(&out[start + sizeof(size)], &sum, sizeof(sum));
+}
+
+void write_all(int fd, const std::string& data)
+{
+    auto first = data.data();
+    auto last  = first + data.size();
+    while (first != last) {
+        auto written = ::write(fd, first, last - first);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error{errno, std::system_category(), "journal"};
+        }
+        first += written;
+    }
+}
+
+} // anonymous namespace
+
+std::string journal_path(const std::string& fname)
+{
+    auto pos = fname.rfind('/');
+    return pos == std::string::npos
+        ? "." + fname + ".ewig-journal"
+        : fname.substr(0, pos + 1) + "." + fname.substr(pos + 1) + ".ewig-journal";
+}
+
+std::optional<text> replay_journal(const std::string& path,
+                                   const file_stamp& stamp,
+                                   text base)
+{
+    if (stamp.inode == 0)
+        return std::nullopt;
+
+    auto file = mapped_file{};
+    try {
+        file = mapped_file{path};
+    } catch (const std::system_error&) {
+        return std::nullopt;
+    }
+
+    auto first  = file.begin();
+    auto last   = file.end();
+    auto magic  = std::string(sizeof(journal_magic), '\0');
+    auto header = file_stamp{};
+    if (std::size_t(last - first) < magic.size() ||
+        !std::equal(first, first + magic.size(), std::begin(journal_magic)))
+        return std::nullopt;
+    first += magic.size();
+    if (!get(first, last, header.inode) ||
+        !get(first, last, header.size) ||
+        !get(first, last, header.mtime_ns) ||
+        !same_stamp(header, stamp))
+        return std::nullopt;
+
+    // most changes replace lines with the same number of them, which
+    // is done in place on a transient, the rest need to slice the text
+    auto content = std::move(base).transient();
+    auto applied = std::size_t{};
+    while (true) {
+        auto size = std::uint32_t{};
+        auto sum  = std::uint32_t{};
+        if (!get(first, last, size) || !get(first, last, sum) ||
+            std::size_t(last - first) < size ||
+            checksum(first, first + size) != sum)
+            break;
+        auto rec     = first;
+        auto end     = first + size;
+        auto row     = std::uint64_t{};
+        auto removed = std::uint64_t{};
+        auto count   = std::uint64_t{};
+        if (!get(rec, end, row) || !get(rec, end, removed) ||
+            !get(rec, end, count) || row + removed > content.size())
+            break;
+        auto lines = text{}.transient();
+        for (auto i = std::uint64_t{}; i < count; ++i) {
+            auto len = std::uint32_t{};
+            if (!get(rec, end, len) || std::size_t(end - rec) < len)
+                break;
+            lines.push_back({rec, rec + len});
+            rec += len;
+        }
+        if (lines.size() != count)
+            break;
+        auto inserted = std::move(lines).persistent();
+        if (removed == count) {
+            for (auto i = std::uint64_t{}; i < count; ++i)
+                content.set(row + i, inserted[i]);
+        } else {
+            auto old = std::move(content).persistent();
+            content  = (old.take(row) + inserted + old.drop(row + removed))
+                .transient();
+        }
+        first = end;
+        ++applied;
+    }
+    if (applied == 0)
+        return std::nullopt;
+    return std::move(content).persistent();
+}
+
+journal::journal(std::chrono::milliseconds sync_interval)
+    : sync_interval_{sync_interval}
+    , thread_{[this] { run_(); }}
+{}
+
+journal::~journal()
+{
+    if (clean_)
+        push_(remove_op{});
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex_};
+        done_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+void journal::update(const buffer& buf)
+{
+    // the content changes while loading are not edits, the journal is
+    // started over once the new file is there
+    if (load_in_progress(buf))
+        return;
+    if (auto file = std::get_if<existing_file>(&buf.from)) {
+        auto path = journal_path(file->name);
+        if (path != path_ || !same_stamp(file->stamp, stamp_)) {
+            path_    = path;
+            stamp_   = file->stamp;
+            content_ = file->content;
+            // without knowing the state of the file the journal could
+            // not be checked against it when recovering
+            active_  = stamp_.inode != 0;
+            if (active_)
+                push_(reset_op{path_, stamp_});
+            else
+                push_(remove_op{});
+        }
+    }
+    clean_ = !is_dirty(buf);
+    if (active_ && buf.content != content_) {
+        auto first  = common_prefix(content_, buf.content);
+        auto suffix = common_suffix(content_, buf.content, first);
+        auto lines  = buf.content.take(buf.content.size() - suffix).drop(first);
+        push_(change_op{first, content_.size() - first - suffix, lines});
+        content_ = buf.content;
+    }
+}
+
+void journal::discard()
+{
+    active_ = false;
+    clean_  = true;
+    push_(remove_op{});
+}
+
+void journal::push_(operation op)
+{
+    {
+        auto lock = std::lock_guard<std::mutex>{mutex_};
+        pending_.push_back(std::move(op));
+    }
+    cond_.notify_one();
+}
+
+void journal::run_()
+{
+    using clock = std::chrono::steady_clock;
+
+    auto fd       = -1;
+    auto path     = std::string{};
+    auto data     = std::string{};
+    auto ops      = std::vector<operation>{};
+    auto unsynced = false;
+    auto sync_at  = clock::time_point{};
+    auto lock     = std::unique_lock<std::mutex>{mutex_};
+    auto close    = [&] {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        unsynced = false;
+    };
+    while (true) {
+        auto ready = [&] { return done_ || !pending_.empty(); };
+        if (unsynced)
+            cond_.wait_until(lock, sync_at, ready);
+        else
+            cond_.wait(lock, ready);
+        auto done = done_;
+        std::swap(ops, pending_);
+        lock.unlock();
+
+        // the journal is a best effort, when something fails it stops
+        // being written until the next reset
+        try {
+            for (auto& op : ops) {
+                scelta::match(
+                    [&] (const reset_op& op) {
+                        close();
+                        data.clear();
+                        path = op.path;
+                        fd = ::open(path.c_str(),
+                                    O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                                    0600);
+                        if (fd >= 0)
+                            encode_header(data, op.stamp);
+                    },
+                    [&] (const remove_op&) {
+                        close();
+                        data.clear();
+                        if (!path.empty())
+                            ::unlink(path.c_str());
+                        path.clear();
+                    },
+                    [&] (const change_op& op) {
+                        if (fd >= 0)
+                            encode_change(data, op.first, op.removed, op.lines);
+                    })(op);
+            }
+            ops.clear();
+            if (fd >= 0 && !data.empty()) {
+                write_all(fd, data);
+                data.clear();
+                if (!unsynced)
+                    sync_at = clock::now() + sync_interval_;
+                unsynced = true;
+            }
+            if (unsynced && (done || clock::now() >= sync_at)) {
+                ::fsync(fd);
+                unsynced = false;
+            }
+        } catch (const std::system_error&) {
+            close();
+            data.clear();
+        }
+
+        if (done)
+            break;
+        lock.lock();
+    }
+    close();
+}
+
+} // namespace ewig
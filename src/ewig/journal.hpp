@@ -0,0 +1,114 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <ewig/buffer.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace ewig {
+
+/**
+ * Returns the path of the journal of the file `fname`, which is a
+ * hidden file next to it.
+ */
+std::string journal_path(const std::string& fname);
+
+/**
+ * Applies the changes recorded in the journal at `path` to `base`, the
+ * content of the file it was written for.  Returns nothing when there
+ * is no journal, when it has no changes, or when it was written for
+ * another version of the file, as told by `stamp`.  A truncated or
+ * corrupt tail, as left by a crash in the middle of a write, is
+ * ignored.
+ */
+std::optional<text> replay_journal(const std::string& path,
+                                   const file_stamp& stamp,
+                                   text base);
+
+/**
+ * Keeps an append-only journal of the changes to the content of a
+ * buffer since it was last loaded or saved, so they can be recovered
+ * after a crash.
+ *
+ * `update()` is meant to be called with every new state of the buffer.
+ * It finds out what lines changed, which is cheap since successive
+ * contents share most of their structure, and queues them.  A
+ * background thread writes the queued changes in batches and syncs
+ * the file at most once every `sync_interval`, so the caller never
+ * waits for the disk.
+ *
+ * When destroyed, the pending changes are written and the journal is
+ * removed if the buffer had no unsaved changes or it was discarded.
+ * Otherwise it is kept, as when the editor fails with an exception,
+ * and recovered the next time the file is loaded.
+ */
+struct journal
+{
+    explicit journal(std::chrono::milliseconds sync_interval =
+                         std::chrono::seconds{1});
+    ~journal();
+
+    journal(const journal&) = delete;
+    journal& operator=(const journal&) = delete;
+
+    void update(const buffer& buf);
+
+    /**
+     * Removes the journal, even if there are unsaved changes, which
+     * happens when the user quits without saving them on purpose.
+     */
+    void discard();
+
+private:
+    struct reset_op { std::string path; file_stamp stamp; };
+    struct remove_op {};
+    struct change_op { std::size_t first; std::size_t removed; text lines; };
+    using operation = std::variant<reset_op, remove_op, change_op>;
+
+    void push_(operation op);
+    void run_();
+
+    // state of the buffer seen by update(), only used by its caller
+    std::string path_;
+    file_stamp stamp_;
+    text content_;
+    bool active_ = false;
+    bool clean_ = true;
+
+    // shared with the writer thread
+    std::chrono::milliseconds sync_interval_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<operation> pending_;
+    bool done_ = false;
+    std::thread thread_;
+};
+
+} // namespace ewig
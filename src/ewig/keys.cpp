@@ -37,19 +37,37 @@ namespace ewig {
 
 key_map make_key_map(std::initializer_list<std::pair<key_seq, std::string>> args)
 {
-    auto map = typename key_map::value_type{};
+    auto nodes = std::vector<key_node>(1);
     for (auto item : args) {
-        auto kseq = key_seq{};
+        auto node = key_map_root;
         for (auto kcode : item.first) {
-            if (!map[kseq]->empty())
+            if (!nodes[node].command->empty())
                 throw std::runtime_error{"ambiguous bindings"};
-            kseq = kseq.push_back(kcode);
+            auto it = nodes[node].next.find(kcode);
+            if (it != nodes[node].next.end())
+                node = it->second;
+            else {
+                nodes[node].next.emplace(kcode, nodes.size());
+                node = nodes.size();
+                nodes.emplace_back();
+            }
         }
-        auto res = map.emplace(std::move(kseq), std::move(item.second));
-        if (!res.second)
+        if (!nodes[node].next.empty())
+            throw std::runtime_error{"ambiguous bindings"};
+        if (node == key_map_root || !nodes[node].command->empty())
             throw std::runtime_error{"dupplicate binding"};
+        nodes[node].command = std::move(item.second);
     }
-    return map;
+    return nodes;
+}
+
+key_node_id next_key_node(const key_map& map, key_node_id node, const key_code& key)
+{
+    if (node >= map->size())
+        return key_map_none;
+    const auto& next = (*map)[node].next;
+    auto it = next.find(key);
+    return it != next.end() ? it->second : key_map_none;
 }
 
 std::string to_string(const key_code& k)
@@ -27,6 +27,10 @@
 #include <immer/box.hpp>
 #include <immer/algorithm.hpp>
 
+#include <lager/extra/struct.hpp>
+
+#include <limits>
+#include <string>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -35,13 +39,41 @@ namespace ewig {
 
 using key_code = std::tuple<int, wint_t>;
 using key_seq  = immer::vector<key_code>;
-using key_map  = immer::box<std::unordered_map<key_seq, immer::box<std::string>>>;
 
-// Builds a keymap from `args`.  It also associates all key sequence
-// prefixes to the empty string, and checks for ambiguous key command
-// sequences.
+// Key maps are a trie of the bound key sequences, where the state of
+// the input is just the node reached by the keys pressed so far.
+using key_node_id = std::size_t;
+
+// Commands are identified by their position in the table of commands
+// of the application, see `resolve_commands()`
+using command_id = std::size_t;
+
+constexpr auto no_command = std::numeric_limits<command_id>::max();
+
+struct key_node
+{
+    std::unordered_map<key_code, key_node_id> next;
+    // empty for the nodes of sequences that are only a prefix
+    immer::box<std::string> command;
+    command_id id = no_command;
+};
+
+using key_map  = immer::box<std::vector<key_node>>;
+
+// Node where every key sequence starts
+constexpr auto key_map_root = key_node_id{0};
+
+// Node reached by a sequence that does not lead to any binding
+constexpr auto key_map_none = std::numeric_limits<key_node_id>::max();
+
+// Builds a keymap from `args`.  It checks for ambiguous key command
+// sequences, where a binding is a prefix of another.
 key_map make_key_map(std::initializer_list<std::pair<key_seq, std::string>>);
 
+// Returns the node reached by pressing `key` at `node`, or
+// `key_map_none` when no binding continues that way.
+key_node_id next_key_node(const key_map& map, key_node_id node, const key_code& key);
+
 std::string to_string(const key_code& k);
 std::string to_string(const key_seq& keys);
 
@@ -86,3 +118,5 @@ auto seq(T arg, Ts... args)
 
 } // namespace key
 } // namespace ewig
+
+LAGER_STRUCT(ewig, key_node, next, command, id);
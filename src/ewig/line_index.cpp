@@ -0,0 +1,269 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/line_index.hpp"
+#include "ewig/buffer.hpp"
+
+#include <immer/algorithm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+namespace ewig {
+
+namespace {
+
+// What a chunk of a line contributes to its index.  Since tabs stop at
+// multiples of `tab_width`, how many columns a chunk spans depends on
+// the column where it starts modulo `tab_width`.
+struct chunk_summary
+{
+    /** Offset in the chunk of its first code point, if `chars > 0` */
+    std::size_t first_char = 0;
+    index chars = 0;
+    bool ascii = true;
+    bool tabs = false;
+    std::array<index, tab_width> columns = {};
+};
+
+chunk_summary summarize_chunk(const char* first, const char* last)
+{
+    auto result = chunk_summary{};
+    for (auto p = first; p != last; ++p) {
+        auto c = static_cast<unsigned char>(*p);
+        if ((c & 0xc0) == 0x80)
+            continue;  // continuation byte
+        if (!result.chars++)
+            result.first_char = p - first;
+        result.ascii = result.ascii && c < 0x80;
+        result.tabs  = result.tabs || c == '\t';
+    }
+    if (!result.tabs) {
+        result.columns.fill(result.chars);
+    } else {
+        for (auto start = index{}; start < tab_width; ++start) {
+            auto column = start;
+            for (auto p = first; p != last; ++p) {
+                auto c = static_cast<unsigned char>(*p);
+                if (c == '\t')
+                    column += tab_width - (column % tab_width);
+                else if ((c & 0xc0) != 0x80)
+                    ++column;
+            }
+            result.columns[start] = column - start;
+        }
+    }
+    return result;
+}
+
+template <typename T>
+std::size_t hash_combine(std::size_t seed, const T& x)
+{
+    return seed ^ (std::hash<T>{}(x) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// Two lines with the same nodes have the same content.
+struct line_key
+{
+    const void* root;
+    const void* tail;
+    std::size_t size;
+    std::size_t shift;
+
+    line_key(const line& ln)
+        : root{ln.impl().root}
+        , tail{ln.impl().tail}
+        , size{ln.impl().size}
+        , shift{ln.impl().shift}
+    {}
+
+    bool operator==(const line_key& other) const
+    {
+        return root == other.root && tail == other.tail
+            && size == other.size && shift == other.shift;
+    }
+};
+
+struct line_key_hash
+{
+    std::size_t operator()(const line_key& k) const
+    {
+        auto h = std::hash<const void*>{}(k.root);
+        h = hash_combine(h, k.tail);
+        h = hash_combine(h, k.size);
+        return hash_combine(h, k.shift);
+    }
+};
+
+using chunk_key = std::pair<const char*, const char*>;
+
+struct chunk_key_hash
+{
+    std::size_t operator()(const chunk_key& k) const
+    {
+        return hash_combine(std::hash<const char*>{}(k.first), k.second);
+    }
+};
+
+struct cached_line
+{
+    line ln;
+    std::shared_ptr<const line_index> index;
+    std::uint64_t last_use;
+};
+
+struct cached_chunk
+{
+    chunk_summary summary;
+    std::size_t lines;
+};
+
+// The cached lines are kept alive, so neither their nodes nor their
+// chunks can be freed and their memory reused by other lines while
+// they are in the cache.  This makes their addresses good keys.  Every
+// chunk summary counts how many cached lines use it, and is dropped
+// along with the last of them.
+struct line_index_cache
+{
+    std::unordered_map<line_key, cached_line, line_key_hash> lines;
+    std::unordered_map<chunk_key, cached_chunk, chunk_key_hash> chunks;
+    std::size_t capacity = default_line_index_cache_size;
+    std::uint64_t uses = 0;
+
+    static line_index_cache& get()
+    {
+        thread_local auto cache = line_index_cache{};
+        return cache;
+    }
+
+    const chunk_summary& acquire_chunk(const char* first, const char* last)
+    {
+        auto [it, inserted] = chunks.try_emplace({first, last});
+        if (inserted)
+            it->second.summary = summarize_chunk(first, last);
+        ++it->second.lines;
+        return it->second.summary;
+    }
+
+    void release_chunks(const line& ln)
+    {
+        immer::for_each_chunk(ln, [&] (auto first, auto last) {
+            auto it = chunks.find({first, last});
+            if (it != chunks.end() && !--it->second.lines)
+                chunks.erase(it);
+        });
+    }
+
+    void evict()
+    {
+        while (lines.size() > capacity) {
+            auto oldest = std::min_element(
+                lines.begin(), lines.end(), [] (auto& a, auto& b) {
+                    return a.second.last_use < b.second.last_use;
+                });
+            release_chunks(oldest->second.ln);
+            lines.erase(oldest);
+        }
+    }
+
+    std::shared_ptr<const line_index> make_index(const line& ln)
+    {
+        auto idx    = std::make_shared<line_index>();
+        auto offset = std::size_t{};
+        auto column = index{};
+        immer::for_each_chunk(ln, [&] (auto first, auto last) {
+            const auto& chunk = acquire_chunk(first, last);
+            if (chunk.chars > 0)
+                idx->checkpoints.push_back(
+                    {offset + chunk.first_char, idx->length, column});
+            idx->length += chunk.chars;
+            idx->ascii   = idx->ascii && chunk.ascii;
+            idx->tabs    = idx->tabs || chunk.tabs;
+            column += chunk.columns[column % tab_width];
+            offset += last - first;
+        });
+        if (idx->ascii && !idx->tabs) {
+            idx->checkpoints.clear();
+            idx->checkpoints.shrink_to_fit();
+        }
+        return idx;
+    }
+};
+
+template <typename Key>
+line_index::checkpoint find_checkpoint(const line_index& idx, index n, Key key)
+{
+    auto it = std::upper_bound(
+        idx.checkpoints.begin(), idx.checkpoints.end(), n,
+        [&] (index n, const line_index::checkpoint& p) {
+            return n < key(p);
+        });
+    return it == idx.checkpoints.begin()
+        ? line_index::checkpoint{}
+        : *std::prev(it);
+}
+
+} // anonymous namespace
+
+std::shared_ptr<const line_index> get_line_index(const line& ln)
+{
+    auto& cache = line_index_cache::get();
+    auto [it, inserted] = cache.lines.try_emplace(ln);
+    auto& entry = it->second;
+    if (inserted) {
+        entry.ln    = ln;
+        entry.index = cache.make_index(ln);
+    }
+    entry.last_use = ++cache.uses;
+    auto result = entry.index;
+    if (inserted)
+        cache.evict();
+    return result;
+}
+
+void reserve_line_index_cache(std::size_t size)
+{
+    auto& cache = line_index_cache::get();
+    cache.capacity = std::max(cache.capacity, size);
+}
+
+line_index::checkpoint find_char(const line_index& idx, index n)
+{
+    if (idx.checkpoints.empty()) {
+        n = std::clamp(n, index{}, idx.length);
+        return {std::size_t(n), n, n};
+    }
+    return find_checkpoint(idx, n, [] (auto& p) { return p.chars; });
+}
+
+line_index::checkpoint find_column(const line_index& idx, index col)
+{
+    if (idx.checkpoints.empty()) {
+        col = std::clamp(col, index{}, idx.length);
+        return {std::size_t(col), col, col};
+    }
+    return find_checkpoint(idx, col, [] (auto& p) { return p.column; });
+}
+
+} // namespace ewig
@@ -0,0 +1,111 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/coord.hpp>
+#include <ewig/text.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace ewig {
+
+/**
+ * Lines shorter than this many bytes are cheap enough to walk that
+ * indexing them is not worth it.
+ */
+constexpr auto line_index_min_size = std::size_t{256};
+
+/**
+ * Number of line indices that are cached per thread by default.  It
+ * should be more than the rows in the screen.
+ */
+constexpr auto default_line_index_cache_size = std::size_t{128};
+
+/**
+ * Summary of a line that allows finding characters and columns in it
+ * without walking it from the start.
+ *
+ * A line is stored in chunks of bounded size, the leaves of its tree,
+ * and the index records where the first code point of each chunk is.
+ * Finding a position is then a binary search plus a walk within one
+ * chunk.  Chunks are summarized only once, while some cached line uses
+ * them, so indexing a line after an edit only reads the bytes of the
+ * chunks that the edit changed.  It still visits every chunk of the
+ * line, though, looking up its summary and adding it to the prefix
+ * sums, so it takes time linear in the number of chunks, with a small
+ * constant, rather than logarithmic.
+ */
+struct line_index
+{
+    struct checkpoint
+    {
+        /** Offset of the first byte of the code point */
+        std::size_t offset;
+        /** Number of code points before it */
+        index chars;
+        /** Column where it is displayed, with tabs expanded */
+        index column;
+    };
+
+    /** Number of code points in the line */
+    index length = 0;
+    /** Whether all code points are single bytes */
+    bool ascii = true;
+    /** Whether the line has tab characters */
+    bool tabs = false;
+    /**
+     * Position of the first code point of every chunk.  It is left
+     * empty when every byte is a code point of a single column, since
+     * then positions can be computed directly.
+     */
+    std::vector<checkpoint> checkpoints;
+};
+
+/**
+ * Returns the index of the line `ln`.  The indices of the lines that
+ * were used last are cached per thread and identified by the structure
+ * of the line, so asking again for the same, unmodified line is cheap.
+ */
+std::shared_ptr<const line_index> get_line_index(const line& ln);
+
+/**
+ * Makes sure that the cache of the calling thread keeps the indices of
+ * at least `size` lines, like the ones in the screen.
+ */
+void reserve_line_index_cache(std::size_t size);
+
+/**
+ * Returns the position of the code point number `n`, or of one before
+ * it that is as close as the index allows.
+ */
+line_index::checkpoint find_char(const line_index& idx, index n);
+
+/**
+ * Returns the position of the code point that is displayed at column
+ * `col`, or of one before it that is as close as the index allows.
+ * The code point may be a tab that spans over `col`.
+ */
+line_index::checkpoint find_column(const line_index& idx, index col);
+
+} // namespace ewig
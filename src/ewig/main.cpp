@@ -20,11 +20,28 @@
 
 #include "ewig/terminal.hpp"
 #include "ewig/draw.hpp"
+#include "ewig/frame_scheduler.hpp"
+#include "ewig/journal.hpp"
+#include "ewig/recording.hpp"
+#include "ewig/stats.hpp"
+#include "ewig/trace.hpp"
 
 #include <lager/store.hpp>
 #include <lager/event_loop/boost_asio.hpp>
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+extern "C" {
+#include <unistd.h>
+}
 
 
 #if EWIG_ENABLE_DEBUGGER
@@ -36,6 +53,7 @@
 
 #include <cereal/types/string.hpp>
 #include <cereal/types/unordered_map.hpp>
+#include <cereal/types/vector.hpp>
 
 namespace cereal {
 
@@ -51,6 +69,42 @@ void load(Archive& ar, std::exception_ptr& e)
 {
 }
 
+// do not serialize file views either, they are just a handle to the
+// mapped file
+
+template <typename Archive>
+void save(Archive& ar, const ewig::text_view& v)
+{
+}
+
+template <typename Archive>
+void load(Archive& ar, ewig::text_view& v)
+{
+}
+
+// the history is a flex_vector, serialize it just as a list
+
+template <typename Archive>
+void save(Archive& ar, const immer::flex_vector<ewig::undo_node>& history)
+{
+    ar(make_size_tag(history.size()));
+    immer::for_each(history, [&] (auto&& node) { ar(node); });
+}
+
+template <typename Archive>
+void load(Archive& ar, immer::flex_vector<ewig::undo_node>& history)
+{
+    auto sz = std::size_t{};
+    ar(make_size_tag(sz));
+    auto t = std::move(history).transient();
+    for (auto i = std::size_t{}; i < sz; ++i) {
+        auto node = ewig::undo_node{};
+        ar(node);
+        t.push_back(node);
+    }
+    history = std::move(t).persistent();
+}
+
 // custom serialization of text to make text look prettier by looking
 // like a list of strings, as opposed to just a list of numbers
 
@@ -111,33 +165,244 @@ const auto key_map_emacs = make_key_map(
     {key::seq(key::ctrl('y')), "paste"},
     {key::seq(key::ctrl('@')), "start-selection"}, // ctrl-space
     {key::seq(key::ctrl('_')), "undo"},
+    {key::seq(key::alt('_')),  "redo"},
     {key::seq(key::ctrl('x'), key::ctrl('C')), "quit"},
     {key::seq(key::ctrl('x'), key::ctrl('S')), "save"},
+    {key::seq(key::ctrl('x'), 'b'), "undo-branch"},
+    {key::seq(key::ctrl('x'), 'e'), "echo-commands"},
     {key::seq(key::ctrl('x'), 'h'), "select-whole-buffer"},
+    {key::seq(key::ctrl('x'), 'u'), "undo-to-time"},
+    {key::seq(key::ctrl('x'), 'm'), "history-memory"},
+    {key::seq(key::ctrl('x'), 'M'), "set-history-budget"},
     {key::seq(key::ctrl('x'), '['), "move-beginning-buffer"},
     {key::seq(key::ctrl('x'), ']'), "move-end-buffer"},
     {key::seq(key::alt('w')),  "copy"},
 });
 
-void run(int argc, const char** argv, const std::string& fname)
+struct options
 {
+    std::string file_name;
+    int max_fps = 0;
+    std::size_t view_threshold = no_view_threshold;
+    bool frame_stats = false;
+    bool vt100 = false;
+    std::string message_log;
+    std::string record;
+    std::string stats;
+    std::string trace;
+    std::string replay;
+    double replay_speed = 1;
+    bool headless = false;
+};
+
+options parse_options(int argc, const char** argv)
+{
+    auto opts = options{};
+    for (auto i = 1; i < argc; ++i) {
+        auto arg = std::string{argv[i]};
+        if (arg.rfind("--max-fps=", 0) == 0) {
+            auto value = arg.substr(10);
+            if (value.empty() || value.size() > 4 ||
+                value.find_first_not_of("0123456789") != std::string::npos)
+                throw std::runtime_error{"invalid frame rate: " + value};
+            opts.max_fps = std::stoi(value);
+        } else if (arg.rfind("--view-threshold=", 0) == 0) {
+            auto value = arg.substr(17);
+            if (value.empty() || value.size() > 9 ||
+                value.find_first_not_of("0123456789") != std::string::npos)
+                throw std::runtime_error{"invalid view threshold: " + value};
+            opts.view_threshold = std::stoul(value) << 20;
+        } else if (arg == "--screen=ncurses" || arg == "--screen=vt100") {
+            opts.vt100 = arg == "--screen=vt100";
+        } else if (arg.rfind("--message-log=", 0) == 0) {
+            opts.message_log = arg.substr(14);
+        } else if (arg == "--frame-stats") {
+            opts.frame_stats = true;
+        } else if (arg.rfind("--stats=", 0) == 0) {
+            opts.stats = arg.substr(8);
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            opts.trace = arg.substr(8);
+        } else if (arg.rfind("--record=", 0) == 0) {
+            opts.record = arg.substr(9);
+        } else if (arg.rfind("--replay=", 0) == 0) {
+            opts.replay = arg.substr(9);
+        } else if (arg.rfind("--replay-speed=", 0) == 0) {
+            auto value = arg.substr(15);
+            auto pos   = std::size_t{};
+            try {
+                opts.replay_speed = std::stod(value, &pos);
+            } catch (const std::logic_error&) {}
+            if (pos != value.size() || !(opts.replay_speed >= 0))
+                throw std::runtime_error{"invalid replay speed: " + value};
+        } else if (arg == "--headless") {
+            opts.headless = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            throw std::runtime_error{"unknown option: " + arg};
+        } else if (opts.file_name.empty()) {
+            opts.file_name = arg;
+        } else {
+            throw std::runtime_error{"give me only one file name"};
+        }
+    }
+    // a recording starts by loading the file that was edited
+    if (opts.replay.empty() && opts.file_name.empty())
+        throw std::runtime_error{"give me a file name"};
+    if (!opts.replay.empty() && !opts.file_name.empty())
+        throw std::runtime_error{"the file name comes from the recording"};
+    if (opts.headless && opts.replay.empty())
+        throw std::runtime_error{"--headless needs --replay"};
+    if (!opts.replay.empty() && !opts.record.empty())
+        throw std::runtime_error{"can not record while replaying"};
+    return opts;
+}
+
+void write_stats_file(const options& opts)
+{
+    if (opts.stats.empty())
+        return;
+    auto file = std::ofstream{opts.stats};
+    write_stats(file, global_stats());
+    if (!file)
+        throw std::system_error{errno, std::system_category(), opts.stats};
+}
+
+application initial_application(const options& opts, coord size)
+{
+    auto app = application{size, resolve_commands(key_map_emacs)};
+    app.current.view_threshold = opts.view_threshold;
+    // a replay leaves the files alone, it would otherwise overwrite
+    // them and start from whatever journal they have
+    app.current.dry_run = !opts.replay.empty();
+    return app;
+}
+
+// Replays a recording without a terminal, as fast as the options say,
+// until the editor quits or there is nothing left to do.
+void run_headless(const options& opts)
+{
+    auto rec     = read_recording(opts.replay);
+    check_recorded_file(rec.file);
+    auto serv    = boost::asio::io_service{};
+    auto store   = lager::make_store<action>(
+        initial_application(opts, {24, 80}),
+        lager::with_boost_asio_event_loop{serv.get_executor(), [] {}});
+    auto player  = action_player{
+        serv, std::move(rec.actions), opts.replay_speed,
+        [&] (auto ev) { store.dispatch(ev); }};
+    watch(store, [&] (auto&& app) { player.update(app); });
+    auto start = std::chrono::steady_clock::now();
+    player.start();
+    serv.run();
+    auto time = std::chrono::steady_clock::now() - start;
+    std::cerr << "replayed " << player.played() << " actions in "
+              << std::chrono::duration<double, std::milli>(time).count()
+              << " ms" << std::endl;
+    write_stats_file(opts);
+}
+
+void run(int argc, const char** argv, const options& opts)
+{
+    if (opts.headless)
+        return run_headless(opts);
+
 #if EWIG_ENABLE_DEBUGGER
     auto debugger =
         lager::http_debug_server{argc, argv, 8080, lager::resources_path()};
 #endif
+    auto jrnl = std::optional<journal>{};
+    if (opts.replay.empty())
+        jrnl.emplace();
+    auto msg_log = std::optional<message_log_file>{};
+    if (!opts.message_log.empty())
+        msg_log.emplace(opts.message_log);
+    auto recorder = std::optional<action_recorder>{};
+    if (!opts.record.empty())
+        recorder.emplace(opts.record, read_recorded_file(opts.file_name));
+    auto rec = recording{};
+    if (!opts.replay.empty()) {
+        rec = read_recording(opts.replay);
+        check_recorded_file(rec.file);
+    }
     auto serv = boost::asio::io_service{};
-    auto term = terminal{serv};
-    auto store = lager::make_store<action>(
-        application{term.size(), key_map_emacs},
-        lager::with_boost_asio_event_loop{serv.get_executor(), [&] { term.stop(); }}
+    auto frames_drawn = std::size_t{};
+    auto frames_skipped = std::size_t{};
+    auto output = screen_stats{};
+    // time when the first input that is not on the screen yet arrived
+    auto input_time = std::optional<std::chrono::steady_clock::time_point>{};
+    {
+        auto term = terminal{serv};
+        auto scr = opts.vt100
+            ? make_vt100_screen(STDOUT_FILENO)
+            : make_ncurses_screen(opts.frame_stats);
+        auto frames = frame_scheduler{
+            serv, [&] (auto&& app) {
+                {
+                    auto timer = stats_timer{global_stats().draw};
+                    auto span  = trace_span{"draw"};
+                    draw(*scr, app);
+                }
+                if (input_time) {
+                    global_stats().input_latency.record(
+                        std::chrono::steady_clock::now() - *input_time);
+                    input_time.reset();
+                }
+            }, opts.max_fps};
+        auto store = lager::make_store<action>(
+            initial_application(opts, term.size()),
+            lager::with_boost_asio_event_loop{serv.get_executor(), [&] { term.stop(); }}
 #ifdef EWIG_ENABLE_DEBUGGER
-        , lager::with_debugger(debugger)
+            , lager::with_debugger(debugger)
 #endif
-        );
-    watch(store, draw);
-    term.start([&] (auto ev) { store.dispatch(ev); });
-    store.dispatch(command_action{"load", fname});
-    serv.run();
+            );
+        // only the actions coming from the outside are recorded, the
+        // ones dispatched by effects are produced again when replaying
+        auto dispatch = [&] (action ev) {
+            static const char* const names[] = {
+                "dispatch command", "dispatch key", "dispatch text",
+                "dispatch buffer", "dispatch resize"};
+            auto span = trace_span{names[ev.index()]};
+            if (recorder)
+                recorder->record(ev);
+            if (!input_time)
+                input_time = std::chrono::steady_clock::now();
+            store.dispatch(ev);
+        };
+        auto player = action_player{
+            serv, std::move(rec.actions), opts.replay_speed, dispatch, [&] {
+                store.dispatch(command_action{"message", std::string{"replay finished"},
+                                              no_command, action_time_ms()});
+            }};
+        watch(store, [&] (auto&& app) { frames.update(app); });
+        if (jrnl)
+            watch(store, [&] (auto&& app) { jrnl->update(app.current); });
+        watch(store, [&] (auto&& app) { player.update(app); });
+        if (msg_log)
+            watch(store, [&] (auto&& app) { msg_log->update(app.messages); });
+        if (recorder)
+            recorder->record(resize_action{term.size()});
+        term.start(dispatch);
+        if (opts.replay.empty())
+            dispatch(command_action{"load", opts.file_name,
+                                    no_command, action_time_ms()});
+        else
+            player.start();
+        serv.run();
+        // only reached when quitting, which drops the unsaved changes
+        if (jrnl)
+            jrnl->discard();
+        frames_drawn = frames.frames_drawn();
+        frames_skipped = frames.frames_skipped();
+        output = scr->stats();
+    }
+    if (opts.frame_stats) {
+        auto frames = std::max(output.frames, std::size_t{1});
+        std::cerr << "frames drawn: " << frames_drawn
+                  << ", skipped: " << frames_skipped << std::endl
+                  << "bytes per frame: " << output.bytes / frames
+                  << ", writes per frame: " << double(output.writes) / frames
+                  << std::endl;
+    }
+    write_stats_file(opts);
 }
 
 } // anonymous
@@ -148,11 +413,29 @@ int main(int argc, const char* argv[])
     std::locale::global(std::locale(""));
     ::setlocale(LC_ALL, "");
 
-    if (argc != 2) {
-        std::cerr << "give me a file name" << std::endl;
+    auto opts = ewig::options{};
+    try {
+        opts = ewig::parse_options(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl
+                  << "usage: " << argv[0]
+                  << " [--max-fps=N] [--screen=ncurses|vt100] [--frame-stats]"
+                  << " [--view-threshold=MIB]"
+                  << " [--message-log=LOG] [--stats=STATS] [--trace=TRACE]"
+                  << " [--record=REC] FILE" << std::endl
+                  << "       " << argv[0]
+                  << " [OPTIONS] --replay=REC [--replay-speed=X] [--headless]"
+                  << std::endl;
         return 1;
     }
 
-    ewig::run(argc, argv, argv[1]);
+    try {
+        auto trace = ewig::trace_guard{opts.trace};
+        ewig::trace_thread_name("event loop");
+        ewig::run(argc, argv, opts);
+    } catch (const std::exception& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,136 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/mapped_file.hpp"
+
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+namespace ewig {
+
+namespace {
+
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error{errno, std::system_category(), what};
+}
+
+// Reads what is left in `fd` until its end.
+std::vector<char> read_all(int fd, const std::string& fname)
+{
+    constexpr auto block_size = std::size_t{1} << 16;
+    auto result = std::vector<char>{};
+    auto size   = std::size_t{};
+    while (true) {
+        result.resize(size + block_size);
+        auto count = ::read(fd, result.data() + size, block_size);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            throw_errno(fname);
+        } else if (count == 0) {
+            break;
+        }
+        size += count;
+    }
+    result.resize(size);
+    return result;
+}
+
+} // anonymous namespace
+
+mapped_file::mapped_file(const std::string& fname)
+{
+    auto fd = ::open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw_errno(fname);
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        auto err = errno;
+        ::close(fd);
+        errno = err;
+        throw_errno(fname);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        try {
+            buffer_ = read_all(fd, fname);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        size_ = buffer_.size();
+        if (size_ > 0)
+            data_ = buffer_.data();
+        return;
+    }
+    try {
+        stamp_ = get_file_stamp(fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    size_ = stamp_.size;
+    if (size_ > 0) {
+        auto addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            auto err = errno;
+            ::close(fd);
+            errno = err;
+            throw_errno(fname);
+        }
+        data_ = static_cast<const char*>(addr);
+    }
+    // the mapping stays valid after closing the descriptor
+    ::close(fd);
+}
+
+mapped_file::mapped_file(mapped_file&& other)
+    : data_{std::exchange(other.data_, nullptr)}
+    , size_{std::exchange(other.size_, 0)}
+    , stamp_{std::exchange(other.stamp_, {})}
+    , buffer_{std::move(other.buffer_)}
+{}
+
+mapped_file& mapped_file::operator=(mapped_file&& other)
+{
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(stamp_, other.stamp_);
+    std::swap(buffer_, other.buffer_);
+    return *this;
+}
+
+mapped_file::~mapped_file()
+{
+    if (data_ && buffer_.empty())
+        ::munmap(const_cast<char*>(data_), size_);
+}
+
+} // namespace ewig
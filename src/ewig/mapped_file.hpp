@@ -0,0 +1,67 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/file_stamp.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ewig {
+
+/**
+ * Read-only memory mapping of the whole contents of a file.  The
+ * constructor throws `std::system_error` when the file can not be
+ * opened or mapped.  Empty files are valid and map to an empty range.
+ *
+ * Files that can not be mapped because they are not regular files,
+ * like pipes or terminals, are read into memory instead, until their
+ * end.  Their stamp is unknown, since they can not be read again.
+ */
+struct mapped_file
+{
+    mapped_file() = default;
+    explicit mapped_file(const std::string& fname);
+
+    mapped_file(mapped_file&& other);
+    mapped_file& operator=(mapped_file&& other);
+    ~mapped_file();
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+    /** State of the file at the moment it was mapped */
+    const file_stamp& stamp() const { return stamp_; }
+
+private:
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    file_stamp stamp_;
+    // the contents when they were read instead of mapped
+    std::vector<char> buffer_;
+};
+
+} // namespace ewig
@@ -0,0 +1,95 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/message_log.hpp"
+
+#include <immer/vector_transient.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <iomanip>
+#include <system_error>
+
+namespace ewig {
+
+message_log push_message(message_log log, message msg)
+{
+    if (log.ring.size() < log.capacity) {
+        log.ring = std::move(log.ring).push_back(std::move(msg));
+    } else {
+        log.ring  = std::move(log.ring).set(log.first, std::move(msg));
+        log.first = (log.first + 1) % log.ring.size();
+    }
+    ++log.total;
+    return log;
+}
+
+message_log set_message_log_capacity(message_log log, std::size_t capacity)
+{
+    capacity = std::max(capacity, std::size_t{1});
+    auto count = std::min(log.ring.size(), capacity);
+    auto ring  = immer::vector<message>{}.transient();
+    for (auto i = log.ring.size() - count; i < log.ring.size(); ++i)
+        ring.push_back(get_message(log, i));
+    log.ring     = ring.persistent();
+    log.first    = 0;
+    log.capacity = capacity;
+    return log;
+}
+
+const message& get_message(const message_log& log, std::size_t i)
+{
+    return log.ring[(log.first + i) % log.ring.size()];
+}
+
+message last_message(const message_log& log)
+{
+    return log.ring.empty()
+        ? message{}
+        : get_message(log, log.ring.size() - 1);
+}
+
+message_log_file::message_log_file(const std::string& fname)
+    : file_{fname, std::ios::app}
+{
+    if (!file_)
+        throw std::system_error{errno, std::system_category(), fname};
+}
+
+void message_log_file::update(const message_log& log)
+{
+    if (log.total == written_)
+        return;
+    auto kept = log.total - log.ring.size();
+    if (written_ < kept) {
+        file_ << "... " << kept - written_ << " messages lost\n";
+        written_ = kept;
+    }
+    for (; written_ < log.total; ++written_) {
+        const auto& msg = get_message(log, written_ - kept);
+        auto time = msg.time_stamp;
+        file_ << std::put_time(std::localtime(&time), "%F %T") << " "
+              << msg.content.get() << '\n';
+    }
+    file_.flush();
+}
+
+} // namespace ewig
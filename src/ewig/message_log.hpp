@@ -0,0 +1,98 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <immer/box.hpp>
+#include <immer/vector.hpp>
+
+#include <lager/extra/struct.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <string>
+
+namespace ewig {
+
+struct message
+{
+    std::time_t time_stamp;
+    immer::box<std::string> content;
+};
+
+/**
+ * Number of messages that are kept by default.
+ */
+constexpr auto default_message_log_capacity = std::size_t{256};
+
+/**
+ * The most recent messages, up to `capacity` of them.  Older messages
+ * are dropped as new ones come in, so the memory used stays bounded.
+ * The messages are kept in a ring, where `first` is the position of
+ * the oldest one once it is full.
+ */
+struct message_log
+{
+    immer::vector<message> ring;
+    std::size_t first = 0;
+    std::size_t capacity = default_message_log_capacity;
+    /** Number of messages that were ever logged */
+    std::uint64_t total = 0;
+};
+
+message_log push_message(message_log log, message msg);
+
+/** Keeps only the last `capacity` messages, which must be at least one */
+message_log set_message_log_capacity(message_log log, std::size_t capacity);
+
+/** Returns the `i`-th message that is still kept, from older to newer */
+const message& get_message(const message_log& log, std::size_t i);
+
+/** Returns the most recent message, or an empty one if there is none */
+message last_message(const message_log& log);
+
+/**
+ * Appends all the messages of a log to a file as they come in, so that
+ * they are still available after they are dropped from the log.
+ *
+ * `update()` is meant to be called with every new state of the log.
+ * If more messages were logged in between than the log keeps, the
+ * file says how many were lost.
+ */
+class message_log_file
+{
+public:
+    /** Throws `std::system_error` when the file can not be opened */
+    explicit message_log_file(const std::string& fname);
+
+    void update(const message_log& log);
+
+private:
+    std::ofstream file_;
+    std::uint64_t written_ = 0;
+};
+
+} // namespace ewig
+
+LAGER_STRUCT(ewig, message, time_stamp, content);
+LAGER_STRUCT(ewig, message_log, ring, first, capacity, total);
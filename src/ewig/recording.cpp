@@ -0,0 +1,372 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/recording.hpp"
+#include "ewig/mapped_file.hpp"
+
+#include <scelta.hpp>
+
+#include <cerrno>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <system_error>
+
+namespace ewig {
+
+namespace {
+
+// A recording starts with this header and the file that the session
+// loaded first, followed by the actions.  Each action is the
+// microseconds since the previous one, a tag with its type and its
+// fields, including the time it was stamped with, so that replaying it
+// updates the state exactly the same way.  Numbers are stored as
+// LEB128 varints and strings as their size followed by their bytes.
+//
+//     header: magic name exists size hash
+//     action: delta tag time? fields
+//
+const auto recording_header = std::string{"ewig-rec\x03", 9};
+
+enum class action_tag : std::uint8_t
+{
+    command,
+    key,
+    text,
+    resize,
+};
+
+enum class arg_tag : std::uint8_t
+{
+    none,
+    string,
+    character,
+};
+
+void put_varint(std::string& out, std::uint64_t x)
+{
+    while (x >= 0x80) {
+        out.push_back(char(x | 0x80));
+        x >>= 7;
+    }
+    out.push_back(char(x));
+}
+
+void put_string(std::string& out, const std::string& str)
+{
+    put_varint(out, str.size());
+    out += str;
+}
+
+// FNV-1a, which is enough to notice that a file changed
+std::uint64_t hash_bytes(const char* first, const char* last)
+{
+    auto hash = std::uint64_t{14695981039346656037u};
+    for (; first != last; ++first)
+        hash = (hash ^ std::uint8_t(*first)) * 1099511628211u;
+    return hash;
+}
+
+void put_tag(std::string& out, action_tag tag)
+{
+    out.push_back(char(tag));
+}
+
+void put_action(std::string& out, const action& act)
+{
+    scelta::match(
+        [&] (const command_action& act) {
+            put_tag(out, action_tag::command);
+            put_varint(out, std::uint64_t(act.time_ms));
+            // commands are stored by name, since their identifiers may
+            // change from one version of the editor to another
+            put_string(out, act.name.get());
+            scelta::match(
+                [&] (const none_t&) {
+                    out.push_back(char(arg_tag::none));
+                },
+                [&] (const std::string& str) {
+                    out.push_back(char(arg_tag::string));
+                    put_string(out, str);
+                },
+                [&] (wchar_t c) {
+                    out.push_back(char(arg_tag::character));
+                    put_varint(out, std::uint32_t(c));
+                })(act.arg);
+        },
+        [&] (const key_action& act) {
+            put_tag(out, action_tag::key);
+            put_varint(out, std::uint64_t(act.time_ms));
+            put_varint(out, std::uint32_t(std::get<0>(act.key)));
+            put_varint(out, std::uint32_t(std::get<1>(act.key)));
+        },
+        [&] (const text_action& act) {
+            put_tag(out, action_tag::text);
+            put_varint(out, std::uint64_t(act.time_ms));
+            put_string(out, act.text.get());
+        },
+        [&] (const resize_action& act) {
+            put_tag(out, action_tag::resize);
+            put_varint(out, std::uint32_t(act.size.row));
+            put_varint(out, std::uint32_t(act.size.col));
+        },
+        [&] (const buffer_action&) {
+            throw std::logic_error{"buffer actions can not be recorded"};
+        })(act);
+}
+
+struct truncated_recording {};
+
+struct reader
+{
+    const char* first;
+    const char* last;
+
+    bool done() const { return first == last; }
+
+    std::uint8_t byte()
+    {
+        if (first == last)
+            throw truncated_recording{};
+        return *first++;
+    }
+
+    std::uint64_t varint()
+    {
+        auto x = std::uint64_t{};
+        for (auto shift = 0; shift < 64; shift += 7) {
+            auto b = byte();
+            x |= std::uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return x;
+        }
+        throw std::runtime_error{"invalid number in recording"};
+    }
+
+    std::string string()
+    {
+        auto size = varint();
+        if (size > std::uint64_t(last - first))
+            throw truncated_recording{};
+        auto str = std::string{first, first + size};
+        first += size;
+        return str;
+    }
+
+    recorded_file file()
+    {
+        auto result   = recorded_file{};
+        result.name   = string();
+        result.exists = byte() != 0;
+        result.size   = varint();
+        result.hash   = varint();
+        return result;
+    }
+
+    action next_action()
+    {
+        switch (action_tag(byte())) {
+        case action_tag::command: {
+            auto time = std::int64_t(varint());
+            auto name = string();
+            auto arg  = arg_t{};
+            switch (arg_tag(byte())) {
+            case arg_tag::none:
+                break;
+            case arg_tag::string:
+                arg = string();
+                break;
+            case arg_tag::character:
+                arg = wchar_t(varint());
+                break;
+            default:
+                throw std::runtime_error{"invalid argument in recording"};
+            }
+            return command_action{name, arg, find_command(name), time};
+        }
+        case action_tag::key: {
+            auto time = std::int64_t(varint());
+            auto res  = int(std::uint32_t(varint()));
+            auto key  = wint_t(varint());
+            return key_action{{res, key}, time};
+        }
+        case action_tag::text: {
+            auto time = std::int64_t(varint());
+            return text_action{string(), time};
+        }
+        case action_tag::resize: {
+            auto row = index(varint());
+            auto col = index(varint());
+            return resize_action{{row, col}};
+        }
+        default:
+            throw std::runtime_error{"invalid action in recording"};
+        }
+    }
+};
+
+} // anonymous namespace
+
+recorded_file read_recorded_file(const std::string& fname)
+{
+    auto result = recorded_file{fname};
+    try {
+        auto file     = mapped_file{fname};
+        result.exists = true;
+        result.size   = file.size();
+        result.hash   = hash_bytes(file.begin(), file.end());
+    } catch (const std::system_error& err) {
+        if (err.code() != std::errc::no_such_file_or_directory)
+            throw;
+    }
+    return result;
+}
+
+void check_recorded_file(const recorded_file& file)
+{
+    auto now = read_recorded_file(file.name);
+    if (now.exists != file.exists || now.size != file.size ||
+        now.hash != file.hash)
+        throw std::runtime_error{
+            file.name + " is not as when the session was recorded"};
+}
+
+action_recorder::action_recorder(const std::string& fname,
+                                 const recorded_file& file)
+    : file_{fname, std::ios::binary | std::ios::trunc}
+    , start_{clock::now()}
+    , last_{}
+{
+    if (!file_)
+        throw std::system_error{errno, std::system_category(), fname};
+    buffer_ = recording_header;
+    put_string(buffer_, file.name);
+    buffer_.push_back(char(file.exists));
+    put_varint(buffer_, file.size);
+    put_varint(buffer_, file.hash);
+    file_.write(buffer_.data(), buffer_.size());
+    file_.flush();
+}
+
+void action_recorder::record(const action& act)
+{
+    using namespace std::chrono;
+    auto time = duration_cast<microseconds>(clock::now() - start_);
+    buffer_.clear();
+    put_varint(buffer_, (time - last_).count());
+    put_action(buffer_, act);
+    last_ = time;
+    // written right away, so that the recording of a session that ends
+    // up crashing is complete
+    file_.write(buffer_.data(), buffer_.size());
+    file_.flush();
+}
+
+recording read_recording(const std::string& fname)
+{
+    auto file = std::ifstream{fname, std::ios::binary};
+    if (!file)
+        throw std::system_error{errno, std::system_category(), fname};
+    auto data = std::string{std::istreambuf_iterator<char>{file}, {}};
+    if (file.bad())
+        throw std::system_error{errno, std::system_category(), fname};
+    if (data.compare(0, recording_header.size(), recording_header) != 0)
+        throw std::runtime_error{"not an ewig recording: " + fname};
+
+    auto result = recording{};
+    auto in     = reader{data.data() + recording_header.size(),
+                         data.data() + data.size()};
+    auto time   = std::chrono::microseconds{};
+    try {
+        result.file = in.file();
+    } catch (const truncated_recording&) {
+        throw std::runtime_error{"not an ewig recording: " + fname};
+    }
+    try {
+        while (!in.done()) {
+            auto delta = std::chrono::microseconds(in.varint());
+            auto act   = in.next_action();
+            time += delta;
+            result.actions.push_back({time, std::move(act)});
+        }
+    } catch (const truncated_recording&) {}
+    return result;
+}
+
+action_player::action_player(boost::asio::io_service& serv,
+                             std::vector<recorded_action> actions,
+                             double speed,
+                             dispatch_fn dispatch,
+                             done_fn done)
+    : serv_{serv}
+    , timer_{serv}
+    , actions_{std::move(actions)}
+    , speed_{speed}
+    , dispatch_{std::move(dispatch)}
+    , done_{std::move(done)}
+{}
+
+void action_player::start()
+{
+    due_ = clock::now();
+    schedule_();
+}
+
+void action_player::update(const application& app)
+{
+    busy_ = io_in_progress(app.current);
+    if (!busy_ && waiting_) {
+        waiting_ = false;
+        due_ = clock::now();
+        serv_.post([this] { play_(); });
+    }
+}
+
+void action_player::schedule_()
+{
+    if (next_ == actions_.size()) {
+        if (done_)
+            done_();
+    } else if (speed_ <= 0) {
+        serv_.post([this] { play_(); });
+    } else {
+        auto prev = next_ ? actions_[next_ - 1].time : std::chrono::microseconds{};
+        auto gap  = std::chrono::duration<double, std::micro>(
+            actions_[next_].time - prev) / speed_;
+        due_ += std::chrono::duration_cast<clock::duration>(gap);
+        timer_.expires_at(due_);
+        timer_.async_wait([this] (auto ec) {
+            if (!ec) play_();
+        });
+    }
+}
+
+void action_player::play_()
+{
+    if (busy_) {
+        waiting_ = true;
+        return;
+    }
+    dispatch_(actions_[next_++].act);
+    schedule_();
+}
+
+} // namespace ewig
@@ -0,0 +1,158 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/application.hpp>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace ewig {
+
+/**
+ * An action that the store received, `time` after the recording
+ * started.
+ */
+struct recorded_action
+{
+    std::chrono::microseconds time;
+    action act;
+};
+
+/**
+ * The file that a recorded session starts by loading, with a hash of
+ * its content, so that a replay can check that it starts from the same
+ * one.
+ */
+struct recorded_file
+{
+    std::string name;
+    bool exists = false;
+    std::uint64_t size = 0;
+    std::uint64_t hash = 0;
+};
+
+/**
+ * Reads the file `fname` as it is now.  Throws `std::system_error` when
+ * it exists but can not be read.
+ */
+recorded_file read_recorded_file(const std::string& fname);
+
+/**
+ * Throws `std::runtime_error` when `file` is not as it was recorded.
+ */
+void check_recorded_file(const recorded_file& file);
+
+/**
+ * Writes the actions received from the outside of the store, like keys
+ * and resizes, to a file as they come in, in a compact binary format.
+ * Actions dispatched by effects are not meant to be recorded: they are
+ * produced again when the recorded ones are replayed.
+ */
+class action_recorder
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Records to `fname` a session that starts with `file`.  Throws
+     * `std::system_error` when the file can not be opened.
+     */
+    action_recorder(const std::string& fname, const recorded_file& file);
+
+    void record(const action& act);
+
+private:
+    std::ofstream file_;
+    clock::time_point start_;
+    std::chrono::microseconds last_;
+    std::string buffer_;
+};
+
+struct recording
+{
+    recorded_file file;
+    std::vector<recorded_action> actions;
+};
+
+/**
+ * Reads a recorded session.  A truncated last action, as left when the
+ * editor crashed while recording, is ignored.  Throws
+ * `std::system_error` when the file can not be read and
+ * `std::runtime_error` when it is not a valid recording.
+ */
+recording read_recording(const std::string& fname);
+
+/**
+ * Dispatches recorded actions with the same time between them as when
+ * they were recorded, divided by `speed`, or as fast as possible when
+ * `speed` is zero.
+ *
+ * The time that loading or saving a file takes varies from run to run,
+ * so no action is dispatched while one is in progress, which
+ * `update()` has to be called with every new state to find out.
+ */
+class action_player
+{
+public:
+    using clock       = std::chrono::steady_clock;
+    using dispatch_fn = std::function<void(action)>;
+    using done_fn     = std::function<void()>;
+
+    action_player(boost::asio::io_service& serv,
+                  std::vector<recorded_action> actions,
+                  double speed,
+                  dispatch_fn dispatch,
+                  done_fn done = {});
+
+    void start();
+
+    void update(const application& app);
+
+    /** Number of actions that were dispatched so far */
+    std::size_t played() const { return next_; }
+
+private:
+    void schedule_();
+    void play_();
+
+    boost::asio::io_service& serv_;
+    boost::asio::steady_timer timer_;
+    std::vector<recorded_action> actions_;
+    double speed_;
+    dispatch_fn dispatch_;
+    done_fn done_;
+    clock::time_point due_;
+    std::size_t next_ = 0;
+    bool busy_ = false;
+    bool waiting_ = false;
+};
+
+} // namespace ewig
@@ -0,0 +1,196 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/scan.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) && defined(__x86_64__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define EWIG_SCAN_AVX2 1
+#else
+#define EWIG_SCAN_AVX2 0
+#endif
+
+namespace ewig {
+
+namespace {
+
+using scan_fn = const char* (*) (const char*, const char*);
+
+// Returns the first byte in [first, last) that is not ASCII, or `last`.
+const char* skip_ascii_scalar(const char* first, const char* last)
+{
+    constexpr auto high_bits = std::uint64_t{0x8080808080808080};
+    for (; last - first >= 8; first += 8) {
+        auto word = std::uint64_t{};
+        std::memcpy(&word, first, 8);
+        if (word & high_bits)
+            break;
+    }
+    while (first != last && !(*first & 0x80))
+        ++first;
+    return first;
+}
+
+const char* find_newline_scalar(const char* first, const char* last)
+{
+    auto p = std::memchr(first, '\n', last - first);
+    return p ? static_cast<const char*>(p) : last;
+}
+
+#ifdef __SSE2__
+
+const char* skip_ascii_sse2(const char* first, const char* last)
+{
+    for (; last - first >= 16; first += 16) {
+        auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        auto mask = _mm_movemask_epi8(v);
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return skip_ascii_scalar(first, last);
+}
+
+const char* find_newline_sse2(const char* first, const char* last)
+{
+    auto nl = _mm_set1_epi8('\n');
+    for (; last - first >= 16; first += 16) {
+        auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_newline_scalar(first, last);
+}
+
+#endif // __SSE2__
+
+#if EWIG_SCAN_AVX2
+
+__attribute__((target("avx2")))
+const char* skip_ascii_avx2(const char* first, const char* last)
+{
+    for (; last - first >= 32; first += 32) {
+        auto v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        auto mask = (unsigned) _mm256_movemask_epi8(v);
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return skip_ascii_sse2(first, last);
+}
+
+__attribute__((target("avx2")))
+const char* find_newline_avx2(const char* first, const char* last)
+{
+    auto nl = _mm256_set1_epi8('\n');
+    for (; last - first >= 32; first += 32) {
+        auto v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        auto mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask)
+            return first + __builtin_ctz(mask);
+    }
+    return find_newline_sse2(first, last);
+}
+
+bool has_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif // EWIG_SCAN_AVX2
+
+const auto skip_ascii = [] () -> scan_fn {
+#if EWIG_SCAN_AVX2
+    if (has_avx2())
+        return skip_ascii_avx2;
+#endif
+#ifdef __SSE2__
+    return skip_ascii_sse2;
+#else
+    return skip_ascii_scalar;
+#endif
+} ();
+
+const auto find_newline_impl = [] () -> scan_fn {
+#if EWIG_SCAN_AVX2
+    if (has_avx2())
+        return find_newline_avx2;
+#endif
+#ifdef __SSE2__
+    return find_newline_sse2;
+#else
+    return find_newline_scalar;
+#endif
+} ();
+
+// Returns the length of the well formed utf-8 sequence at `first`, or
+// zero if it is malformed, as described in table 3-7 of the Unicode
+// standard.
+int sequence_length(const unsigned char* first, const unsigned char* last)
+{
+    auto avail = last - first;
+    auto c     = first[0];
+    auto trail = [&] (int i, unsigned char lo = 0x80, unsigned char hi = 0xbf) {
+        return i < avail && first[i] >= lo && first[i] <= hi;
+    };
+    if (c < 0x80)
+        return 1;
+    else if (c < 0xc2)
+        return 0;
+    else if (c < 0xe0)
+        return trail(1) ? 2 : 0;
+    else if (c < 0xf0)
+        return trail(1, c == 0xe0 ? 0xa0 : 0x80, c == 0xed ? 0x9f : 0xbf)
+            && trail(2) ? 3 : 0;
+    else if (c < 0xf5)
+        return trail(1, c == 0xf0 ? 0x90 : 0x80, c == 0xf4 ? 0x8f : 0xbf)
+            && trail(2) && trail(3) ? 4 : 0;
+    else
+        return 0;
+}
+
+} // anonymous namespace
+
+const char* find_newline(const char* first, const char* last)
+{
+    return find_newline_impl(first, last);
+}
+
+bool is_valid_utf8(const char* first, const char* last)
+{
+    while ((first = skip_ascii(first, last)) != last) {
+        auto n = sequence_length(reinterpret_cast<const unsigned char*>(first),
+                                 reinterpret_cast<const unsigned char*>(last));
+        if (!n)
+            return false;
+        first += n;
+    }
+    return true;
+}
+
+} // namespace ewig
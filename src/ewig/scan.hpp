@@ -0,0 +1,40 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+namespace ewig {
+
+/**
+ * Returns a pointer to the first newline character in the range
+ * [first, last), or `last` if there is none.
+ */
+const char* find_newline(const char* first, const char* last);
+
+/**
+ * Returns whether [first, last) is a sequence of well formed utf-8
+ * code points, using the same rules as `utf8::find_invalid`.  Pure
+ * ASCII blocks are checked many bytes at a time, so this is much
+ * faster than validating code point by code point.
+ */
+bool is_valid_utf8(const char* first, const char* last);
+
+} // namespace ewig
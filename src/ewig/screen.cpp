@@ -0,0 +1,179 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/screen.hpp"
+
+#include <atomic>
+#include <cwchar>
+#include <fstream>
+#include <string>
+
+extern "C" {
+
+#ifndef _XOPEN_SOURCE_EXTENDED
+    #define _XOPEN_SOURCE_EXTENDED
+#endif
+
+#include <ncurses.h>
+}
+
+namespace ewig {
+
+namespace {
+
+std::atomic<std::uint64_t> next_screen_id{0};
+
+enum class color
+{
+    message = 1,
+    selection,
+    mode_line_message,
+};
+
+attr_t face_attributes(face f)
+{
+    switch (f) {
+    case face::selection:         return COLOR_PAIR((int)color::selection);
+    case face::mode_line:         return A_REVERSE;
+    case face::mode_line_message: return A_BOLD | COLOR_PAIR((int)color::mode_line_message);
+    case face::message:           return COLOR_PAIR((int)color::message);
+    default:                      return A_NORMAL;
+    }
+}
+
+// Number of cells that ncurses uses to display `c`, where control
+// characters are displayed like ^X
+int cell_width(wchar_t c)
+{
+    auto w = ::wcwidth(c);
+    return w >= 0 ? w : 2;
+}
+
+// Bytes and write system calls done so far by the current thread, as
+// reported by Linux, or zeroes when that is not available.
+std::pair<std::size_t, std::size_t> thread_io()
+{
+    auto io     = std::ifstream{"/proc/thread-self/io"};
+    auto key    = std::string{};
+    auto val    = std::size_t{};
+    auto bytes  = std::size_t{};
+    auto writes = std::size_t{};
+    while (io >> key >> val) {
+        if (key == "wchar:")
+            bytes = val;
+        else if (key == "syscw:")
+            writes = val;
+    }
+    return {bytes, writes};
+}
+
+struct ncurses_screen : screen
+{
+    ncurses_screen(bool count_output)
+        : count_output_{count_output}
+    {
+        ::start_color();
+        ::use_default_colors();
+        ::init_pair((int)color::message,   COLOR_YELLOW, -1);
+        ::init_pair((int)color::selection, COLOR_BLACK, COLOR_YELLOW);
+        ::init_pair((int)color::mode_line_message, COLOR_WHITE, COLOR_RED);
+    }
+
+    void resize(coord size) override
+    {
+        // ncurses already knows the size of the terminal
+        ::erase();
+    }
+
+    index put(coord pos, std::wstring_view str, face f) override
+    {
+        auto maxcol = getmaxx(stdscr);
+        auto count  = std::size_t{};
+        auto col    = pos.col;
+        for (; count < str.size(); ++count) {
+            auto w = cell_width(str[count]);
+            if (col + w > maxcol)
+                break;
+            col += w;
+        }
+        ::attrset(face_attributes(f));
+        ::move(pos.row, pos.col);
+        ::addnwstr(str.data(), count);
+        return col;
+    }
+
+    void clear_line(coord pos, face f) override
+    {
+        ::move(pos.row, pos.col);
+        ::attrset(face_attributes(f));
+        if (f == face::normal)
+            ::clrtoeol();
+        else {
+            auto spaces = std::wstring(std::max(getmaxx(stdscr) - pos.col, 0), L' ');
+            ::addnwstr(spaces.c_str(), spaces.size());
+        }
+    }
+
+    void show_cursor(std::optional<coord> pos) override
+    {
+        cursor_ = pos;
+    }
+
+    void flush() override
+    {
+        if (cursor_)
+            ::move(cursor_->row, cursor_->col);
+        ::curs_set(bool(cursor_));
+        ++stats_.frames;
+        if (count_output_) {
+            auto [bytes, writes] = thread_io();
+            ::refresh();
+            auto [bytes_after, writes_after] = thread_io();
+            stats_.bytes  += bytes_after - bytes;
+            stats_.writes += writes_after - writes;
+        } else {
+            ::refresh();
+        }
+    }
+
+    screen_stats stats() const override
+    {
+        return stats_;
+    }
+
+private:
+    bool count_output_;
+    std::optional<coord> cursor_;
+    screen_stats stats_;
+};
+
+} // anonymous namespace
+
+screen::screen()
+    : id_{next_screen_id++}
+{}
+
+std::unique_ptr<screen> make_ncurses_screen(bool count_output)
+{
+    return std::make_unique<ncurses_screen>(count_output);
+}
+
+} // namespace ewig
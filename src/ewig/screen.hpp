@@ -0,0 +1,110 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/coord.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace ewig {
+
+/** How a piece of text is displayed */
+enum class face
+{
+    normal,
+    selection,
+    mode_line,
+    mode_line_message,
+    message,
+};
+
+/** Output sent to the terminal so far */
+struct screen_stats
+{
+    std::size_t frames = 0;
+    std::size_t bytes  = 0;
+    std::size_t writes = 0;
+};
+
+/**
+ * Where the editor draws itself.  Drawing happens on a frame that is
+ * only shown on the terminal when flushed, and only what changed since
+ * the previous frame is sent.
+ */
+class screen
+{
+public:
+    virtual ~screen() = default;
+
+    /** Identifies this screen among all that were created */
+    std::uint64_t id() const { return id_; }
+
+    /**
+     * Makes the frame of `size`, clearing it and assuming nothing about
+     * what is currently shown on the terminal.
+     */
+    virtual void resize(coord size) = 0;
+
+    /**
+     * Draws `str` starting at `pos`, clipped to the end of the row.
+     * Returns the column after the last cell that was drawn.
+     */
+    virtual index put(coord pos, std::wstring_view str, face f) = 0;
+
+    /** Fills the row with spaces from `pos` until its end */
+    virtual void clear_line(coord pos, face f) = 0;
+
+    /** Places the cursor at `pos`, or hides it if there is none */
+    virtual void show_cursor(std::optional<coord> pos) = 0;
+
+    /** Sends the frame to the terminal */
+    virtual void flush() = 0;
+
+    virtual screen_stats stats() const = 0;
+
+protected:
+    screen();
+
+private:
+    std::uint64_t id_;
+};
+
+/**
+ * Draws with ncurses, that must have been initialized already, as done
+ * by `terminal`.  ncurses does its own writes, so the bytes and writes
+ * in the stats are only measured, from `/proc`, with `count_output`.
+ */
+std::unique_ptr<screen> make_ncurses_screen(bool count_output = false);
+
+/**
+ * Draws writing VT100 escape sequences directly to the file descriptor
+ * `fd`, with a single `write()` per frame.  The terminal must have
+ * been set up already, as done by `terminal`, which is also used to
+ * read the input.
+ */
+std::unique_ptr<screen> make_vt100_screen(int fd);
+
+} // namespace ewig
@@ -0,0 +1,161 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace ewig {
+
+namespace {
+
+std::string format_duration(histogram::duration d)
+{
+    char buf[32];
+    auto ns = double(d.count());
+    if (ns < 1e3)
+        std::snprintf(buf, sizeof(buf), "%.0fns", ns);
+    else if (ns < 1e6)
+        std::snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1e9)
+        std::snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else
+        std::snprintf(buf, sizeof(buf), "%.1fs", ns / 1e9);
+    return buf;
+}
+
+std::string summary(const char* name, const histogram& hist)
+{
+    return std::string{name}
+        + " p50 " + format_duration(hist.percentile(50))
+        + " p99 " + format_duration(hist.percentile(99));
+}
+
+void write_row(std::ostream& os, const std::string& name, const histogram& hist)
+{
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "%-32s %10llu %10s %10s %10s %10s %10s %10s\n",
+                  name.c_str(),
+                  (unsigned long long) hist.count(),
+                  format_duration(hist.mean()).c_str(),
+                  format_duration(hist.percentile(50)).c_str(),
+                  format_duration(hist.percentile(90)).c_str(),
+                  format_duration(hist.percentile(99)).c_str(),
+                  format_duration(hist.percentile(99.9)).c_str(),
+                  format_duration(hist.max()).c_str());
+    os << buf;
+}
+
+} // anonymous namespace
+
+void histogram::record(duration d)
+{
+    auto ns = std::uint64_t(std::max(d.count(), duration::rep{}));
+    ++buckets_[bucket(ns)];
+    ++count_;
+    sum_ += ns;
+    max_ = std::max(max_, ns);
+}
+
+histogram::duration histogram::mean() const
+{
+    return duration{count_ ? sum_ / count_ : 0};
+}
+
+histogram::duration histogram::percentile(double p) const
+{
+    if (!count_)
+        return {};
+    auto rank = std::max<std::uint64_t>(
+        1, std::uint64_t(std::ceil(p / 100 * count_)));
+    auto seen = std::uint64_t{};
+    for (auto b = std::size_t{}; b < buckets_.size(); ++b) {
+        seen += buckets_[b];
+        if (seen >= rank)
+            return duration{std::min(bucket_max(b), max_)};
+    }
+    return duration{max_};
+}
+
+// Values below `sub_buckets` get a bucket each.  The others go to the
+// bucket of their power of two, `e`, and of the next `sub_bits` bits.
+std::size_t histogram::bucket(std::uint64_t ns)
+{
+    if (ns < sub_buckets)
+        return ns;
+    auto e     = 63 - __builtin_clzll(ns);
+    auto shift = e - sub_bits;
+    auto sub   = (ns >> shift) & (sub_buckets - 1);
+    return (shift + 1) * sub_buckets + sub;
+}
+
+std::uint64_t histogram::bucket_max(std::size_t b)
+{
+    if (b < sub_buckets)
+        return b;
+    auto shift = b / sub_buckets - 1;
+    auto sub   = std::uint64_t(b % sub_buckets);
+    auto lower = (std::uint64_t{1} << (shift + sub_bits)) | (sub << shift);
+    return lower + ((std::uint64_t{1} << shift) - 1);
+}
+
+stats& global_stats()
+{
+    static auto s = stats{};
+    return s;
+}
+
+histogram& get_command_stats(stats& s, std::size_t id, const char* name)
+{
+    if (id >= s.commands.size())
+        s.commands.resize(id + 1);
+    auto& cmd = s.commands[id];
+    if (cmd.name.empty())
+        cmd.name = name;
+    return cmd.time;
+}
+
+std::string stats_summary(const stats& s)
+{
+    return summary("update", s.update)
+        + ", " + summary("draw", s.draw)
+        + ", " + summary("latency", s.input_latency)
+        + " (" + std::to_string(s.draw.count()) + " frames)";
+}
+
+void write_stats(std::ostream& os, const stats& s)
+{
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "%-32s %10s %10s %10s %10s %10s %10s %10s\n",
+                  "", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    os << buf;
+    write_row(os, "update", s.update);
+    write_row(os, "effects", s.effects);
+    write_row(os, "draw", s.draw);
+    write_row(os, "input-latency", s.input_latency);
+    for (auto& cmd : s.commands)
+        if (cmd.time.count())
+            write_row(os, "command " + cmd.name, cmd.time);
+}
+
+} // namespace ewig
@@ -0,0 +1,127 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ewig {
+
+/**
+ * Distribution of durations, kept in buckets whose width grows with the
+ * value, like in HDR histograms: each power of two is split in
+ * `histogram_sub_buckets` buckets, so the values reported are at most
+ * that fraction above the real ones.  Recording is just incrementing
+ * a counter.
+ */
+class histogram
+{
+public:
+    using duration = std::chrono::nanoseconds;
+
+    void record(duration d);
+
+    std::uint64_t count() const { return count_; }
+    duration max() const { return duration{max_}; }
+    duration mean() const;
+
+    /** Upper bound of the `p` percentile, `p` going from 0 to 100 */
+    duration percentile(double p) const;
+
+private:
+    static constexpr auto sub_bits = 3;
+    static constexpr auto sub_buckets = 1 << sub_bits;
+
+    static std::size_t bucket(std::uint64_t ns);
+    static std::uint64_t bucket_max(std::size_t b);
+
+    std::array<std::uint64_t, 64 * sub_buckets> buckets_ = {};
+    std::uint64_t count_ = 0;
+    std::uint64_t sum_ = 0;
+    std::uint64_t max_ = 0;
+};
+
+struct command_stats
+{
+    std::string name;
+    histogram time;
+};
+
+/**
+ * Timing of the editor.  They are only recorded from the thread of the
+ * event loop, thus there is no synchronization.
+ */
+struct stats
+{
+    /** Time spent in `update()`, including commands */
+    histogram update;
+    /** Time spent running the effects returned by `update()`, noops aside */
+    histogram effects;
+    /** Time spent drawing a frame, including writing it out */
+    histogram draw;
+    /** Time from an input arriving to the frame that shows it */
+    histogram input_latency;
+    /** Time spent in each command, by command id */
+    std::vector<command_stats> commands;
+};
+
+stats& global_stats();
+
+/** Returns the histogram of command `id`, called `name` */
+histogram& get_command_stats(stats& s, std::size_t id, const char* name);
+
+/** Summary of the main histograms that fits in the message line */
+std::string stats_summary(const stats& s);
+
+/** Writes all the histograms in a table, one per line */
+void write_stats(std::ostream& os, const stats& s);
+
+/**
+ * Records in a histogram the time from its construction to its
+ * destruction.
+ */
+class stats_timer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit stats_timer(histogram& hist)
+        : hist_{hist}
+        , start_{clock::now()}
+    {}
+
+    stats_timer(const stats_timer&) = delete;
+    stats_timer& operator=(const stats_timer&) = delete;
+
+    ~stats_timer() { hist_.record(clock::now() - start_); }
+
+private:
+    histogram& hist_;
+    clock::time_point start_;
+};
+
+} // namespace ewig
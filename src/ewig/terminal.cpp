@@ -19,11 +19,15 @@
 //
 
 #include "ewig/terminal.hpp"
-#include "ewig/draw.hpp"
 
 #include <boost/asio/read.hpp>
+#include <utf8.h>
 
+#include <algorithm>
+#include <cwctype>
 #include <iostream>
+#include <iterator>
+#include <vector>
 
 extern "C" {
 
@@ -53,11 +57,10 @@ terminal::terminal(boost::asio::io_service& serv)
     ::keypad(stdscr, true);
     ::nodelay(stdscr, true);
 
-    ::start_color();
-    ::use_default_colors();
-    ::init_pair((int)color::message,   COLOR_YELLOW, -1);
-    ::init_pair((int)color::selection, COLOR_BLACK, COLOR_YELLOW);
-    ::init_pair((int)color::mode_line_message, COLOR_WHITE, COLOR_RED);
+    // let ncurses do its initial output now, otherwise it would do it
+    // when first reading a key, overwriting what a screen that does not
+    // draw through ncurses may have drawn
+    ::refresh();
 }
 
 coord terminal::size()
@@ -92,6 +95,8 @@ void terminal::next_resize_()
                 ::perror("TIOCGWINSZ");
             else {
                 ::resizeterm(ws.ws_row, ws.ws_col);
+                // take the resized window as drawn, as above
+                ::wnoutrefresh(stdscr);
                 handler_(resize_action{{ws.ws_row, ws.ws_col}});
             }
         }
@@ -103,11 +108,27 @@ void terminal::next_key_()
     using namespace boost::asio;
     input_.async_read_some(null_buffers(), [&] (auto ec, auto) {
         if (!ec) {
-            auto key = wint_t{};
-            auto res = int{};
-            while (ERR != (res = ::wget_wch(win_.get(), &key))) {
-                next_key_();
-                handler_(key_action{{res, key}});
+            auto key  = wint_t{};
+            auto res  = int{};
+            auto keys = std::vector<key_code>{};
+            while (ERR != (res = ::wget_wch(win_.get(), &key)))
+                keys.push_back({res, key});
+            auto time = action_time_ms();
+            next_key_();
+            // runs of printable characters, as when pasting or typing
+            // faster than we draw, are sent as a single action
+            auto printable = [] (const key_code& k) {
+                return std::get<0>(k) == OK && !std::iswcntrl(std::get<1>(k));
+            };
+            for (auto it = keys.begin(); it != keys.end();) {
+                auto run = std::find_if_not(it, keys.end(), printable);
+                if (run - it > 1) {
+                    auto str = std::string{};
+                    for (; it != run; ++it)
+                        utf8::append(std::get<1>(*it), std::back_inserter(str));
+                    handler_(text_action{str, time});
+                } else
+                    handler_(key_action{*it++, time});
             }
         }
     });
@@ -0,0 +1,192 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/text_view.hpp"
+#include "ewig/scan.hpp"
+
+#include <immer/flex_vector_transient.hpp>
+
+#include <utf8.h>
+
+#include <algorithm>
+#include <future>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ewig {
+
+namespace {
+
+constexpr auto page_lines       = index{1024};
+constexpr auto max_cached_pages = std::size_t{64};
+
+// Files are only split for counting their lines in parallel in chunks
+// of at least this size.
+constexpr auto min_count_chunk_bytes = std::size_t{1} << 24;
+
+std::size_t count_newlines(const char* first, const char* last)
+{
+    auto count = std::size_t{};
+    while (first != last) {
+        auto eol = find_newline(first, last);
+        if (eol == last)
+            break;
+        first = eol + 1;
+        ++count;
+    }
+    return count;
+}
+
+} // anonymous namespace
+
+struct text_view::impl
+{
+    using page_list = std::list<std::pair<index, text>>;
+
+    mapped_file file;
+    std::mutex mutex;
+    // start of the first line of every page indexed so far
+    std::vector<const char*> pages;
+    // start of the first line that has not been indexed yet
+    const char* indexed;
+    index lines = 0;
+    // decoded pages, the most recently used first
+    page_list cache;
+    std::unordered_map<index, page_list::iterator> cached_pages;
+
+    impl(mapped_file f)
+        : file{std::move(f)}
+        , indexed{file.begin()}
+    {}
+
+    // Makes sure that the lines up to `row` are indexed, if the file
+    // has that many.
+    void index_until(index row)
+    {
+        auto last = file.end();
+        while (lines <= row && indexed != last) {
+            if (lines % page_lines == 0)
+                pages.push_back(indexed);
+            auto eol = find_newline(indexed, last);
+            indexed  = eol == last ? last : eol + 1;
+            ++lines;
+        }
+    }
+
+    text decode_page(index n)
+    {
+        index_until((n + 1) * page_lines);
+        auto first   = pages[n];
+        auto last    = n + 1 < (index)pages.size() ? pages[n + 1] : indexed;
+        auto content = text{}.transient();
+        auto invalid = std::string{};
+        while (first != last) {
+            auto eol = find_newline(first, last);
+            if (is_valid_utf8(first, eol)) {
+                content.push_back({first, eol});
+            } else {
+                invalid.clear();
+                utf8::replace_invalid(first, eol, std::back_inserter(invalid));
+                content.push_back({begin(invalid), end(invalid)});
+            }
+            first = eol == last ? last : eol + 1;
+        }
+        return content.persistent();
+    }
+
+    const text& page(index n)
+    {
+        auto it = cached_pages.find(n);
+        if (it != cached_pages.end()) {
+            cache.splice(cache.begin(), cache, it->second);
+        } else {
+            cache.emplace_front(n, decode_page(n));
+            cached_pages[n] = cache.begin();
+            if (cache.size() > max_cached_pages) {
+                cached_pages.erase(cache.back().first);
+                cache.pop_back();
+            }
+        }
+        return cache.front().second;
+    }
+};
+
+text_view::text_view(mapped_file file)
+    : impl_{std::make_shared<impl>(std::move(file))}
+{}
+
+std::size_t text_view::size_bytes() const
+{
+    return impl_ ? impl_->file.size() : 0;
+}
+
+index text_view::count() const
+{
+    if (!impl_)
+        return 0;
+    // the mapping never changes, so it can be read without the lock
+    const auto& file = impl_->file;
+    auto threads = std::clamp<std::size_t>(
+        file.size() / min_count_chunk_bytes, 1,
+        std::max(std::thread::hardware_concurrency(), 1u));
+    auto chunk   = file.size() / threads;
+    auto workers = std::vector<std::future<std::size_t>>{};
+    for (auto i = std::size_t{1}; i < threads; ++i) {
+        auto first = file.begin() + i * chunk;
+        auto last  = i + 1 < threads ? first + chunk : file.end();
+        workers.push_back(std::async(std::launch::async, [=] {
+            return count_newlines(first, last);
+        }));
+    }
+    auto lines = count_newlines(file.begin(),
+                                threads > 1 ? file.begin() + chunk : file.end());
+    for (auto& worker : workers)
+        lines += worker.get();
+    // the last line may not end with a newline
+    if (file.size() > 0 && file.end()[-1] != '\n')
+        ++lines;
+    return lines;
+}
+
+index text_view::size(index upto) const
+{
+    if (!impl_)
+        return 0;
+    auto lock = std::lock_guard<std::mutex>{impl_->mutex};
+    impl_->index_until(upto - 1);
+    return impl_->lines;
+}
+
+line text_view::get(index row) const
+{
+    if (!impl_ || row < 0)
+        return {};
+    auto lock = std::lock_guard<std::mutex>{impl_->mutex};
+    impl_->index_until(row);
+    return row < impl_->lines
+        ? impl_->page(row / page_lines)[row % page_lines]
+        : line{};
+}
+
+} // namespace ewig
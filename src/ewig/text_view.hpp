@@ -0,0 +1,86 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <ewig/coord.hpp>
+#include <ewig/mapped_file.hpp>
+#include <ewig/text.hpp>
+
+#include <memory>
+#include <string>
+
+namespace ewig {
+
+/**
+ * Read-only view of a file whose lines are decoded on demand.
+ *
+ * Opening a view only maps the file.  Line boundaries are indexed
+ * lazily, only as far as the rows that are requested, and the decoded
+ * lines are kept in a bounded cache of pages of consecutive lines.
+ * This allows browsing files that are larger than the available
+ * memory, but also means that the total number of lines is only known
+ * after counting them with `count()`, which scans the whole file.
+ *
+ * Copies of a view share the same mapping and caches, which are
+ * synchronized internally.  A default constructed view is empty and
+ * evaluates to false.
+ */
+class text_view
+{
+public:
+    text_view() = default;
+    explicit text_view(mapped_file file);
+
+    explicit operator bool() const { return bool(impl_); }
+
+    /** Size in bytes of the underlying file */
+    std::size_t size_bytes() const;
+
+    /**
+     * Counts the lines of the whole file, scanning parts of it in
+     * parallel.  This takes long for big files, so it is meant to be
+     * called in the background, and the view is not locked meanwhile.
+     */
+    index count() const;
+
+    /**
+     * Returns the number of lines, but only indexing the file far
+     * enough to know whether there are at least `upto` lines.  The
+     * result may thus be smaller than `count()` but it is never
+     * smaller than `upto` when the file has that many lines.
+     */
+    index size(index upto) const;
+
+    /** Returns the line at `row` or an empty line when out of range */
+    line get(index row) const;
+
+    friend bool operator==(const text_view& a, const text_view& b)
+    { return a.impl_ == b.impl_; }
+    friend bool operator!=(const text_view& a, const text_view& b)
+    { return a.impl_ != b.impl_; }
+
+private:
+    struct impl;
+    std::shared_ptr<impl> impl_;
+};
+
+} // namespace ewig
@@ -0,0 +1,168 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/trace.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <locale>
+#include <mutex>
+#include <system_error>
+
+namespace ewig {
+
+namespace detail {
+std::atomic<bool> tracing{false};
+} // namespace detail
+
+namespace {
+
+using clock = trace_span::clock;
+
+// The events are written as a JSON array, which may be left without
+// the closing bracket, one per line
+struct trace_file
+{
+    std::mutex mutex;
+    std::ofstream file;
+    clock::time_point start;
+    std::atomic<int> next_thread_id{1};
+};
+
+trace_file& the_trace()
+{
+    static auto trace = trace_file{};
+    return trace;
+}
+
+int current_thread_id()
+{
+    thread_local auto id = the_trace().next_thread_id++;
+    return id;
+}
+
+// Writes `d` in microseconds with three decimals.  The editor runs
+// with the locale of the user, which may not use a dot for decimals,
+// so this does not go through printf or the stream.
+void write_us(std::ostream& os, clock::duration d)
+{
+    auto ns = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(),
+                       std::chrono::nanoseconds::rep{});
+    char buf[32];
+    auto end = std::to_chars(buf, buf + sizeof(buf), ns / 1000).ptr;
+    auto frac = ns % 1000;
+    *end++ = '.';
+    *end++ = char('0' + frac / 100);
+    *end++ = char('0' + frac / 10 % 10);
+    *end++ = char('0' + frac % 10);
+    os.write(buf, end - buf);
+}
+
+void write_string(std::ostream& os, const char* str)
+{
+    os << '"';
+    for (; *str; ++str) {
+        auto c = *str;
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if ((unsigned char) c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            os << buf;
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+void write_metadata(std::ostream& os, const char* what, int tid, const char* name)
+{
+    os << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"name\":\""
+       << what << "\",\"args\":{\"name\":";
+    write_string(os, name);
+    os << "}}";
+}
+
+} // anonymous namespace
+
+void start_tracing(const std::string& fname)
+{
+    auto& trace = the_trace();
+    auto lock = std::lock_guard<std::mutex>{trace.mutex};
+    trace.file.open(fname, std::ios::trunc);
+    if (!trace.file)
+        throw std::system_error{errno, std::system_category(), fname};
+    // no digit grouping, whatever the global locale is
+    trace.file.imbue(std::locale::classic());
+    trace.file << "[\n";
+    trace.start = clock::now();
+    detail::tracing = true;
+}
+
+void stop_tracing()
+{
+    auto& trace = the_trace();
+    auto lock = std::lock_guard<std::mutex>{trace.mutex};
+    if (!detail::tracing)
+        return;
+    detail::tracing = false;
+    write_metadata(trace.file, "process_name", 0, "ewig");
+    trace.file << "\n]\n";
+    trace.file.close();
+}
+
+void trace_thread_name(const char* name)
+{
+    if (!tracing_enabled())
+        return;
+    auto& trace = the_trace();
+    auto tid    = current_thread_id();
+    auto lock   = std::lock_guard<std::mutex>{trace.mutex};
+    if (!detail::tracing)
+        return;
+    write_metadata(trace.file, "thread_name", tid, name);
+    trace.file << ",\n";
+}
+
+void trace_span::finish_()
+{
+    auto end    = clock::now();
+    auto& trace = the_trace();
+    auto tid    = current_thread_id();
+    auto lock   = std::lock_guard<std::mutex>{trace.mutex};
+    if (!detail::tracing)
+        return;
+    trace.file << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":";
+    write_string(trace.file, name_);
+    trace.file << ",\"cat\":";
+    write_string(trace.file, category_);
+    trace.file << ",\"ts\":";
+    write_us(trace.file, start_ - trace.start);
+    trace.file << ",\"dur\":";
+    write_us(trace.file, end - start_);
+    trace.file << "},\n";
+}
+
+} // namespace ewig
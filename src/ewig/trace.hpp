@@ -0,0 +1,123 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace ewig {
+
+namespace detail {
+extern std::atomic<bool> tracing;
+} // namespace detail
+
+/**
+ * Returns whether a trace is being written.  Checking this is all that
+ * the trace points cost when tracing is off.
+ */
+inline bool tracing_enabled()
+{
+    return detail::tracing.load(std::memory_order_relaxed);
+}
+
+/**
+ * Starts writing a trace to `fname` in the trace event format, which
+ * can be opened with `chrome://tracing` or Perfetto.  The file can be
+ * opened even when tracing was not stopped, like when the editor
+ * crashed.  Throws `std::system_error` when it can not be created.
+ */
+void start_tracing(const std::string& fname);
+
+/** Stops tracing, finishing the file */
+void stop_tracing();
+
+/**
+ * Traces to `fname`, unless it is empty, for as long as it lives, so
+ * that the file is finished however its scope is left.
+ */
+class trace_guard
+{
+public:
+    explicit trace_guard(const std::string& fname)
+        : active_{!fname.empty()}
+    {
+        if (active_)
+            start_tracing(fname);
+    }
+
+    trace_guard(const trace_guard&) = delete;
+    trace_guard& operator=(const trace_guard&) = delete;
+
+    ~trace_guard()
+    {
+        if (active_)
+            stop_tracing();
+    }
+
+private:
+    bool active_;
+};
+
+/**
+ * Names the calling thread in the trace.  The name must outlive the
+ * trace.
+ */
+void trace_thread_name(const char* name);
+
+/**
+ * Traces the time from its construction to its destruction, on the
+ * thread that constructs it.  `name` and `category` must outlive the
+ * span.
+ */
+class trace_span
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    trace_span(const char* name, const char* category = "ewig")
+    {
+        if (tracing_enabled()) {
+            name_     = name;
+            category_ = category;
+            start_    = clock::now();
+        }
+    }
+
+    trace_span(const trace_span&) = delete;
+    trace_span& operator=(const trace_span&) = delete;
+
+    ~trace_span()
+    {
+        if (name_)
+            finish_();
+    }
+
+private:
+    void finish_();
+
+    const char* name_ = nullptr;
+    const char* category_ = nullptr;
+    clock::time_point start_;
+};
+
+} // namespace ewig
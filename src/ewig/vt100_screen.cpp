@@ -0,0 +1,339 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "ewig/screen.hpp"
+
+#include <utf8.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cwchar>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+extern "C" {
+#include <unistd.h>
+}
+
+namespace ewig {
+
+namespace {
+
+// Unchanged cells between two changed ones are sent anyway when there
+// are fewer than this, since moving the cursor over them takes about as
+// many bytes
+constexpr auto max_gap = 8;
+
+// A cell of the second column of a wide character
+constexpr auto wide_tail = wchar_t{0};
+
+struct cell
+{
+    wchar_t ch = L' ';
+    face f     = face::normal;
+
+    bool operator==(const cell& other) const
+    { return ch == other.ch && f == other.f; }
+    bool operator!=(const cell& other) const
+    { return !(*this == other); }
+};
+
+bool same_cursor(const std::optional<coord>& a, const std::optional<coord>& b)
+{
+    return a && b
+        ? a->row == b->row && a->col == b->col
+        : bool(a) == bool(b);
+}
+
+const char* face_sequence(face f)
+{
+    switch (f) {
+    case face::selection:         return "\x1b[0;30;43m";
+    case face::mode_line:         return "\x1b[0;7m";
+    case face::mode_line_message: return "\x1b[0;1;37;41m";
+    case face::message:           return "\x1b[0;33m";
+    default:                      return "\x1b[0m";
+    }
+}
+
+struct vt100_screen : screen
+{
+    vt100_screen(int fd)
+        : fd_{fd}
+    {}
+
+    ~vt100_screen()
+    {
+        out_ = "\x1b[0m\x1b[?25h";
+        try { write_(); } catch (...) {}
+    }
+
+    void resize(coord size) override
+    {
+        size_ = {std::max(size.row, 0), std::max(size.col, 0)};
+        back_.assign(size_.row * size_.col, cell{});
+        front_.clear();
+    }
+
+    index put(coord pos, std::wstring_view str, face f) override
+    {
+        if (pos.row < 0 || pos.row >= size_.row || pos.col < 0)
+            return pos.col;
+        auto row = back_.begin() + pos.row * size_.col;
+        auto col = pos.col;
+        // do not leave half of a wide character behind
+        if (col < size_.col && row[col].ch == wide_tail && col > 0)
+            row[col - 1].ch = L' ';
+        for (auto c : str) {
+            auto w = ::wcwidth(c);
+            if (w == 0)
+                continue;
+            else if (w < 0)
+                c = L'?', w = 1;
+            if (col + w > size_.col)
+                break;
+            row[col++] = {c, f};
+            if (w == 2)
+                row[col++] = {wide_tail, f};
+        }
+        if (col < size_.col && row[col].ch == wide_tail)
+            row[col].ch = L' ';
+        return col;
+    }
+
+    void clear_line(coord pos, face f) override
+    {
+        if (pos.row < 0 || pos.row >= size_.row)
+            return;
+        auto row = back_.begin() + pos.row * size_.col;
+        auto col = std::max(pos.col, 0);
+        if (col < size_.col && row[col].ch == wide_tail && col > 0)
+            row[col - 1].ch = L' ';
+        std::fill(row + std::min(col, size_.col), row + size_.col, cell{L' ', f});
+    }
+
+    void show_cursor(std::optional<coord> pos) override
+    {
+        cursor_ = pos;
+    }
+
+    void flush() override
+    {
+        out_.clear();
+        if (front_.empty()) {
+            // we know nothing about the terminal, start from scratch
+            out_ += "\x1b[0m\x1b[2J";
+            face_ = face::normal;
+            front_.assign(back_.size(), cell{});
+        } else
+            scroll_();
+        for (auto r = 0; r < size_.row; ++r)
+            diff_row_(r);
+        if (!out_.empty() || !same_cursor(cursor_, shown_cursor_)) {
+            if (!out_.empty() && shown_cursor_)
+                out_.insert(0, "\x1b[?25l");
+            if (cursor_) {
+                move_(*cursor_);
+                out_ += "\x1b[?25h";
+            } else if (shown_cursor_ && out_.empty())
+                out_ += "\x1b[?25l";
+            shown_cursor_ = cursor_;
+        }
+        ++stats_.frames;
+        write_();
+    }
+
+    screen_stats stats() const override
+    {
+        return stats_;
+    }
+
+private:
+    std::vector<std::uint64_t> row_hashes_(const std::vector<cell>& cells) const
+    {
+        auto result = std::vector<std::uint64_t>(size_.row);
+        for (auto r = 0; r < size_.row; ++r) {
+            auto h = std::uint64_t{14695981039346656037u};
+            for (auto c = 0; c < size_.col; ++c) {
+                auto& x = cells[r * size_.col + c];
+                h = (h ^ std::uint64_t(x.ch)) * 1099511628211u;
+                h = (h ^ std::uint64_t(x.f)) * 1099511628211u;
+            }
+            result[r] = h;
+        }
+        return result;
+    }
+
+    bool same_row_(index back_row, index front_row) const
+    {
+        auto back  = back_.begin() + back_row * size_.col;
+        auto front = front_.begin() + front_row * size_.col;
+        return std::equal(back, back + size_.col, front);
+    }
+
+    // When a range of rows of the new frame is what the terminal shows
+    // some rows above or below, as when scrolling, moves it there
+    // scrolling just that region of the terminal, instead of drawing
+    // all of those rows again.
+    void scroll_()
+    {
+        auto rows = size_.row;
+        if (rows < 4)
+            return;
+        auto back_h  = row_hashes_(back_);
+        auto front_h = row_hashes_(front_);
+        auto best_gain = 2, best_k = 0, best_first = 0, best_last = 0;
+        for (auto k = -rows / 2; k <= rows / 2; ++k) {
+            if (k == 0)
+                continue;
+            // rows r of the new frame that are at r + k in the terminal
+            auto first = std::max(0, -k);
+            auto last  = std::min(rows, rows - k);
+            auto start = first;
+            auto gain  = 0;
+            for (auto r = first; r <= last; ++r) {
+                if (r < last && back_h[r] == front_h[r + k] && same_row_(r, r + k)) {
+                    gain += back_h[r] != front_h[r];
+                } else {
+                    if (gain > best_gain)
+                        best_gain = gain, best_k = k, best_first = start, best_last = r;
+                    start = r + 1;
+                    gain  = 0;
+                }
+            }
+        }
+        if (best_k == 0)
+            return;
+        // the region from the top to the bottom of the rows that move,
+        // using only the original VT100 index and reverse index
+        auto k      = best_k;
+        auto top    = k > 0 ? best_first : best_first + k;
+        auto bottom = k > 0 ? best_last + k : best_last;
+        out_ += "\x1b[0m\x1b[";
+        out_ += std::to_string(top + 1);
+        out_ += ';';
+        out_ += std::to_string(bottom);
+        out_ += 'r';
+        face_ = face::normal;
+        move_({k > 0 ? bottom - 1 : top, 0});
+        for (auto i = 0; i < std::abs(k); ++i)
+            out_ += k > 0 ? "\x1b" "D" : "\x1b" "M";
+        out_ += "\x1b[r";
+        auto row = [&] (index r) { return front_.begin() + r * size_.col; };
+        if (k > 0) {
+            for (auto r = top; r < bottom - k; ++r)
+                std::copy(row(r + k), row(r + k + 1), row(r));
+            std::fill(row(bottom - k), row(bottom), cell{});
+        } else {
+            for (auto r = bottom - 1; r >= top - k; --r)
+                std::copy(row(r + k), row(r + k + 1), row(r));
+            std::fill(row(top), row(top - k), cell{});
+        }
+    }
+
+    void diff_row_(index r)
+    {
+        auto back  = back_.begin() + r * size_.col;
+        auto front = front_.begin() + r * size_.col;
+        auto col   = index{};
+        while (col < size_.col) {
+            while (col < size_.col && back[col] == front[col])
+                ++col;
+            if (col == size_.col)
+                break;
+            // a run of changes, including small unchanged gaps
+            auto first = col;
+            auto last  = col;
+            for (auto gap = 0; col < size_.col && gap <= max_gap; ++col) {
+                if (back[col] != front[col])
+                    last = col + 1, gap = 0;
+                else
+                    ++gap;
+            }
+            // wide characters are always sent whole
+            if (back[first].ch == wide_tail || front[first].ch == wide_tail)
+                first = std::max(first - 1, 0);
+            move_({r, first});
+            for (auto c = first; c < last; ++c) {
+                auto& x = back[c];
+                if (x.ch == wide_tail)
+                    continue;
+                if (x.f != face_) {
+                    out_ += face_sequence(x.f);
+                    face_ = x.f;
+                }
+                utf8::append(char32_t(x.ch), std::back_inserter(out_));
+            }
+            std::copy(back + first, back + last, front + first);
+            col = last;
+        }
+    }
+
+    void move_(coord pos)
+    {
+        out_ += "\x1b[";
+        out_ += std::to_string(pos.row + 1);
+        out_ += ';';
+        out_ += std::to_string(pos.col + 1);
+        out_ += 'H';
+    }
+
+    void write_()
+    {
+        auto data = out_.data();
+        auto size = out_.size();
+        while (size > 0) {
+            auto written = ::write(fd_, data, size);
+            ++stats_.writes;
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error{errno, std::system_category(), "write"};
+            }
+            data += written;
+            size -= written;
+            stats_.bytes += written;
+        }
+    }
+
+    int fd_;
+    coord size_ = {0, 0};
+    std::vector<cell> back_;
+    std::vector<cell> front_;
+    std::optional<coord> cursor_;
+    std::optional<coord> shown_cursor_;
+    face face_ = face::normal;
+    std::string out_;
+    screen_stats stats_;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<screen> make_vt100_screen(int fd)
+{
+    return std::make_unique<vt100_screen>(fd);
+}
+
+} // namespace ewig
@@ -0,0 +1,100 @@
+//
+// ewig - an immutable text editor
+// Copyright (C) 2017 Juan Pedro Bolivar Puente
+//
+// This file is part of ewig.
+//
+// ewig is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// ewig is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with ewig.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks that traces are valid JSON whatever the locale of the user,
+// which the editor runs with.  Locales that write decimals with a comma
+// and group digits are tried, both the C one, if available, and a C++
+// one that is always available.
+
+#include <ewig/trace.hpp>
+
+#include <clocale>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <locale>
+#include <string>
+#include <thread>
+
+namespace {
+
+struct comma_numpunct : std::numpunct<char>
+{
+    char do_decimal_point() const override { return ','; }
+    char do_thousands_sep() const override { return '.'; }
+    std::string do_grouping() const override { return "\1"; }
+};
+
+// Returns whether the numbers after "ts" and "dur" are made of digits
+// and at most one dot, and the ones after "tid" only of digits
+bool numbers_are_valid(const std::string& trace)
+{
+    auto count = 0;
+    for (auto key : {"\"ts\":", "\"dur\":", "\"tid\":"}) {
+        auto chars = key[1] == 't' && key[2] == 'i' ? "0123456789" : "0123456789.";
+        auto key_size = std::string{key}.size();
+        for (auto pos = trace.find(key); pos != std::string::npos;
+             pos = trace.find(key, pos + 1)) {
+            auto first = pos + key_size;
+            auto last  = trace.find_first_of(",}", first);
+            auto num   = trace.substr(first, last - first);
+            if (num.empty() ||
+                num.find_first_not_of(chars) != std::string::npos ||
+                num.find('.') != num.rfind('.')) {
+                std::cerr << "invalid number: " << num << std::endl;
+                return false;
+            }
+            ++count;
+        }
+    }
+    return count > 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    for (auto name : {"de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8"})
+        if (std::setlocale(LC_ALL, name))
+            break;
+    std::locale::global(std::locale(std::locale(""), new comma_numpunct));
+
+    auto fname = std::string{argc > 1 ? argv[1] : "ewig-test-trace.json"};
+    {
+        auto guard = ewig::trace_guard{fname};
+        ewig::trace_thread_name("test");
+        // enough threads for their identifiers to need grouping
+        for (auto i = 0; i < 20; ++i)
+            std::thread{[] {
+                for (auto j = 0; j < 100; ++j)
+                    auto span = ewig::trace_span{"span"};
+            }}.join();
+    }
+
+    auto file  = std::ifstream{fname};
+    auto trace = std::string{std::istreambuf_iterator<char>{file}, {}};
+    std::remove(fname.c_str());
+    if (!numbers_are_valid(trace)) {
+        std::cerr << "the trace is not valid JSON in this locale" << std::endl;
+        return 1;
+    }
+    return 0;
+}